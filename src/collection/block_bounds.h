@@ -0,0 +1,62 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include "collection/quantized_bounds.h"
+
+/*
+ * Cursor over a term's variable-sized blocks (as partitioned by optimizer.vbmw.h): block k covers the docs after
+ * wdoc[k - 1] up to and including wdoc[k], and is bounded by its quantized code. The last block ends at
+ * rank_ndocs with a zero bound. Docs are looked up in ascending order; a fresh cursor serves random access.
+ */
+class BlockBoundCursor
+{
+   public:
+    using Code = QuantizedBounds::Code;
+
+    BlockBoundCursor() {}
+
+    BlockBoundCursor(const uint32_t *wdoc, const Code *codes, size_t n, float z) : wdoc(wdoc), codes(codes), n(n), z(z)
+    {
+    }
+
+    /* Moves to the block holding doc (never backwards). */
+    void advance(uint32_t doc)
+    {
+        if (pos < n and wdoc[pos] < doc) pos = std::lower_bound(wdoc + pos + 1, wdoc + n, doc) - wdoc;
+    }
+
+    /* The bound of the current block, or 0 past the last. */
+    float bound() const
+    {
+        return pos < n ? QuantizedBounds::decode(QuantizedBounds::get(codes, pos), z) : 0.0f;
+    }
+
+    /* The last doc of the current block. */
+    uint32_t end() const
+    {
+        return pos < n ? wdoc[pos] : UINT32_MAX;
+    }
+
+    /* The max bound over docs [begin, end), leaving the cursor on the block holding end - 1. */
+    float max_bound(uint32_t begin, uint32_t end)
+    {
+        advance(begin);
+        float ub = bound();
+
+        while (pos + 1 < n and wdoc[pos] < end - 1)
+        {
+            pos++;
+            ub = std::max(ub, bound());
+        }
+
+        return ub;
+    }
+
+   private:
+    const uint32_t *wdoc  = nullptr;
+    const Code *    codes = nullptr;
+    size_t          n     = 0;
+    size_t          pos   = 0;
+    float           z     = 0.0f;
+};
@@ -0,0 +1,481 @@
+#pragma once
+
+#include <emmintrin.h>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "utils/common.h"
+
+/*
+ * The 128-value SSE2 bit-packing kernels: value i goes to lane i % 4, and a block of width w takes 16 * w bytes.
+ */
+struct BP128
+{
+    static constexpr size_t kBlock = 128;
+
+    static void pack(const uint32_t* in, uint8_t* out, size_t width)
+    {
+        if (width == 0) return;
+
+        __m128i  acc   = _mm_setzero_si128();
+        uint32_t shift = 0;
+
+        for (size_t r = 0; r < kBlock / 4; r++)
+        {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 4 * r));
+
+            acc = _mm_or_si128(acc, _mm_sll_epi32(x, _mm_cvtsi32_si128(shift)));
+            shift += width;
+
+            if (shift >= 32)
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out), acc);
+                out += 16;
+                shift -= 32;
+                acc = shift ? _mm_srl_epi32(x, _mm_cvtsi32_si128(width - shift)) : _mm_setzero_si128();
+            }
+        }
+    }
+
+    /*
+     * Unpacks a block into out. With kPrefix, the values are gaps and out gets their prefix sums, starting from
+     * prev and adding kStrict for every value.
+     */
+    template <bool kPrefix, bool kStrict = false>
+    static void unpack(const uint8_t* in, size_t width, uint32_t prev, uint32_t* out)
+    {
+        __m128i carry = _mm_set1_epi32(prev);
+        __m128i ones  = _mm_set1_epi32(kStrict);
+        __m128i mask  = _mm_set1_epi32(width == 32 ? ~0u : (1u << width) - 1);
+
+        __m128i  cur   = width ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(in)) : _mm_setzero_si128();
+        uint32_t shift = 0;
+
+        for (size_t r = 0; r < kBlock / 4; r++)
+        {
+            __m128i x = _mm_srl_epi32(cur, _mm_cvtsi32_si128(shift));
+            shift += width;
+
+            if (shift >= 32 and r + 1 < kBlock / 4)
+            {
+                shift -= 32;
+                in += 16;
+                cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+                if (shift) x = _mm_or_si128(x, _mm_sll_epi32(cur, _mm_cvtsi32_si128(width - shift)));
+            }
+
+            x = _mm_and_si128(x, mask);
+
+            if (kPrefix)
+            {
+                /* Prefix sum over the four lanes, plus the carry from the previous row. */
+                x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+                x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+                x = _mm_add_epi32(x, carry);
+
+                /* Strict lists also add one for every value before, within the row. */
+                if (kStrict) x = _mm_add_epi32(x, _mm_set_epi32(3, 2, 1, 0));
+
+                carry = _mm_add_epi32(_mm_shuffle_epi32(x, 0xFF), ones);
+            }
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4 * r), x);
+        }
+    }
+
+    /* Bit width of the largest of n values. */
+    static size_t width(const uint32_t* in, size_t n)
+    {
+        uint32_t any = 0;
+        for (size_t i = 0; i < n; i++) any |= in[i];
+
+        return any ? 32 - __builtin_clz(any) : 0;
+    }
+};
+
+/*
+ * SIMD-BP128 style block codec for non-decreasing lists (strictly increasing when kStrict).
+ *
+ * The gaps of every 128 values are bit-packed at the width of their largest gap, in the vertical 4-lane layout
+ * of FastPFor's simdbitpacking (value i in lane i % 4), so one block unpacks with 32 SSE shifts and a 4-wide
+ * prefix sum. Each block has a skip entry: its last value (for skipTo) and its offset and width (for skip).
+ *
+ *   [nblocks][last x nblocks][offset x nblocks][bits x nblocks][pad][block 0][block 1]...
+ *
+ * Offsets are relative to block 0; block payloads are 16 * bits bytes. Gaps are value - previous - kStrict,
+ * with the first gap taken from 0 (so doc 0 is representable and prefix sums of freqs - 1 start at 0).
+ *
+ * Exposes the encode()/reader() interface of Compression<>; the encoded size depends on the values.
+ */
+template <typename Value, bool kStrict>
+struct BlockCompression
+{
+    static constexpr size_t kBlock = 128;
+
+    class Reader;
+
+    static size_t encode(const std::vector<Value>& v, uint8_t* buf)
+    {
+        size_t nblocks = (v.size() + kBlock - 1) / kBlock;
+        size_t nbytes  = header_nbytes(nblocks);
+
+        uint32_t* lasts   = reinterpret_cast<uint32_t*>(buf + sizeof(uint32_t));
+        uint32_t* offsets = lasts + nblocks;
+        uint8_t*  bits    = reinterpret_cast<uint8_t*>(offsets + nblocks);
+
+        memset(buf, 0, nbytes);
+        reinterpret_cast<uint32_t*>(buf)[0] = nblocks;
+
+        uint32_t gaps[kBlock];
+        size_t   offset = 0;
+
+        for (size_t b = 0; b < nblocks; b++)
+        {
+            size_t width = block_gaps(v, b, gaps);
+
+            lasts[b]   = v[std::min(v.size(), (b + 1) * kBlock) - 1];
+            offsets[b] = offset;
+            bits[b]    = width;
+
+            BP128::pack(gaps, buf + nbytes + offset, width);
+            offset += 16 * width;
+        }
+
+        return nbytes + offset;
+    }
+
+    /* What encode() returns (and writes). */
+    static size_t encoded_nbytes(const std::vector<Value>& v)
+    {
+        size_t   nblocks = (v.size() + kBlock - 1) / kBlock;
+        size_t   nbytes  = header_nbytes(nblocks);
+        uint32_t gaps[kBlock];
+
+        for (size_t b = 0; b < nblocks; b++) nbytes += 16 * block_gaps(v, b, gaps);
+
+        return nbytes;
+    }
+
+    static Reader reader(size_t bound, size_t size, const uint8_t* buf)
+    {
+        return Reader(bound, size, buf);
+    }
+
+   private:
+    static size_t header_nbytes(size_t nblocks)
+    {
+        return (sizeof(uint32_t) * (1 + 2 * nblocks) + nblocks + 15) / 16 * 16;
+    }
+
+    /* Fills the (zero-padded) gaps of block b and returns their bit width. */
+    static size_t block_gaps(const std::vector<Value>& v, size_t b, uint32_t* gaps)
+    {
+        size_t   begin = b * kBlock;
+        size_t   end   = std::min(v.size(), begin + kBlock);
+
+        for (size_t i = begin; i < end; i++)
+        {
+            uint32_t prev = i ? v[i - 1] + kStrict : 0;
+            assert(v[i] >= prev);
+
+            gaps[i - begin] = v[i] - prev;
+        }
+
+        std::fill(gaps + (end - begin), gaps + kBlock, 0);
+
+        return BP128::width(gaps, kBlock);
+    }
+};
+
+/*
+ * Same protocol as the (unchecked) EliasFanoReader: next() before the first value(), skip() and skipTo() never
+ * past the last value of the list. The current block is kept decoded.
+ */
+template <typename Value, bool kStrict>
+class BlockCompression<Value, kStrict>::Reader
+{
+   public:
+    Reader(size_t bound, size_t size, const uint8_t* buf)
+    {
+        nblocks  = reinterpret_cast<const uint32_t*>(buf)[0];
+        lasts    = reinterpret_cast<const uint32_t*>(buf) + 1;
+        offsets  = lasts + nblocks;
+        bits     = reinterpret_cast<const uint8_t*>(offsets + nblocks);
+        payloads = buf + header_nbytes(nblocks);
+
+        assert(nblocks == (size + kBlock - 1) / kBlock and (not kStrict or lasts[nblocks - 1] == bound));
+    }
+
+    Value value() const
+    {
+        return value_;
+    }
+
+    size_t position() const
+    {
+        return position_;
+    }
+
+    bool next()
+    {
+        position_++;
+        if (irg_unlikely(position_ % kBlock == 0)) decode(position_ / kBlock);
+
+        value_ = values[position_ % kBlock];
+        return true;
+    }
+
+    bool skip(size_t n)
+    {
+        position_ += n;
+        if (position_ / kBlock != block) decode(position_ / kBlock);
+
+        value_ = values[position_ % kBlock];
+        return true;
+    }
+
+    bool skipTo(Value v)
+    {
+        if (position_ != size_t(-1) and v <= value_) return true;
+
+        size_t i = position_ == size_t(-1) ? 0 : position_ % kBlock;
+
+        if (position_ == size_t(-1) or v > lasts[block])
+        {
+            size_t from = position_ == size_t(-1) ? 0 : block + 1;
+            decode(std::lower_bound(lasts + from, lasts + nblocks, v) - lasts);
+            i = 0;
+        }
+
+        while (values[i] < v) i++;
+
+        position_ = block * kBlock + i;
+        value_    = values[i];
+        return true;
+    }
+
+   private:
+    /* Unpacks block b's gaps and prefix-sums them into values. */
+    void decode(size_t b)
+    {
+        block = b;
+        BP128::unpack<true, kStrict>(payloads + offsets[b], bits[b], b ? lasts[b - 1] + kStrict : 0, values);
+    }
+
+    const uint32_t* lasts    = nullptr;
+    const uint32_t* offsets  = nullptr;
+    const uint8_t*  bits     = nullptr;
+    const uint8_t*  payloads = nullptr;
+    size_t          nblocks  = 0;
+
+    size_t block     = size_t(-1);
+    size_t position_ = size_t(-1);
+    Value  value_    = 0;
+
+    alignas(16) uint32_t values[kBlock];
+};
+
+/*
+ * Doc IDs and freqs in one list, block by block: each 128-posting block packs its doc gaps (as in the strict
+ * BlockCompression) immediately followed by its freqs - 1, so a posting's freq sits next to its doc ID and one
+ * cursor serves both. Freqs are plain per-posting values, not prefix sums, and a block's are only unpacked the
+ * first time freq() is asked for one of them.
+ *
+ *   [nblocks][last x nblocks][offset x nblocks][doc bits x nblocks][freq bits x nblocks][pad][block 0]...
+ *
+ * where block b is 16 * (doc bits + freq bits) bytes, its doc payload first.
+ */
+struct InterleavedCompression
+{
+    static constexpr size_t kBlock = BP128::kBlock;
+
+    class Reader;
+
+    /* freqs[i] is the freq - 1 of docs[i]. */
+    static size_t encode(const std::vector<uint32_t>& docs, const std::vector<uint32_t>& freqs, uint8_t* buf)
+    {
+        assert(docs.size() == freqs.size());
+
+        size_t nblocks = (docs.size() + kBlock - 1) / kBlock;
+        size_t nbytes  = header_nbytes(nblocks);
+
+        uint32_t* lasts     = reinterpret_cast<uint32_t*>(buf + sizeof(uint32_t));
+        uint32_t* offsets   = lasts + nblocks;
+        uint8_t*  doc_bits  = reinterpret_cast<uint8_t*>(offsets + nblocks);
+        uint8_t*  freq_bits = doc_bits + nblocks;
+
+        memset(buf, 0, nbytes);
+        reinterpret_cast<uint32_t*>(buf)[0] = nblocks;
+
+        uint32_t gaps[kBlock], fs[kBlock];
+        size_t   offset = 0;
+
+        for (size_t b = 0; b < nblocks; b++)
+        {
+            size_t dw = block(docs, freqs, b, gaps, fs);
+            size_t fw = BP128::width(fs, kBlock);
+
+            lasts[b]     = docs[std::min(docs.size(), (b + 1) * kBlock) - 1];
+            offsets[b]   = offset;
+            doc_bits[b]  = dw;
+            freq_bits[b] = fw;
+
+            BP128::pack(gaps, buf + nbytes + offset, dw);
+            BP128::pack(fs, buf + nbytes + offset + 16 * dw, fw);
+            offset += 16 * (dw + fw);
+        }
+
+        return nbytes + offset;
+    }
+
+    /* What encode() returns (and writes). */
+    static size_t encoded_nbytes(const std::vector<uint32_t>& docs, const std::vector<uint32_t>& freqs)
+    {
+        size_t   nblocks = (docs.size() + kBlock - 1) / kBlock;
+        size_t   nbytes  = header_nbytes(nblocks);
+        uint32_t gaps[kBlock], fs[kBlock];
+
+        for (size_t b = 0; b < nblocks; b++)
+        {
+            size_t dw = block(docs, freqs, b, gaps, fs);
+            nbytes += 16 * (dw + BP128::width(fs, kBlock));
+        }
+
+        return nbytes;
+    }
+
+    static Reader reader(size_t bound, size_t size, const uint8_t* buf);
+
+   private:
+    static size_t header_nbytes(size_t nblocks)
+    {
+        return (sizeof(uint32_t) * (1 + 2 * nblocks) + 2 * nblocks + 15) / 16 * 16;
+    }
+
+    /* Fills the (zero-padded) doc gaps and freqs of block b and returns the width of the gaps. */
+    static size_t block(const std::vector<uint32_t>& docs, const std::vector<uint32_t>& freqs, size_t b,
+                        uint32_t* gaps, uint32_t* fs)
+    {
+        size_t begin = b * kBlock;
+        size_t end   = std::min(docs.size(), begin + kBlock);
+
+        for (size_t i = begin; i < end; i++)
+        {
+            uint32_t prev = i ? docs[i - 1] + 1 : 0;
+            assert(docs[i] >= prev);
+
+            gaps[i - begin] = docs[i] - prev;
+            fs[i - begin]   = freqs[i];
+        }
+
+        std::fill(gaps + (end - begin), gaps + kBlock, 0);
+        std::fill(fs + (end - begin), fs + kBlock, 0);
+
+        return BP128::width(gaps, kBlock);
+    }
+};
+
+/* The protocol of BlockCompression<>::Reader, plus freq() of the current posting. */
+class InterleavedCompression::Reader
+{
+   public:
+    Reader(size_t bound, size_t size, const uint8_t* buf)
+    {
+        nblocks   = reinterpret_cast<const uint32_t*>(buf)[0];
+        lasts     = reinterpret_cast<const uint32_t*>(buf) + 1;
+        offsets   = lasts + nblocks;
+        doc_bits  = reinterpret_cast<const uint8_t*>(offsets + nblocks);
+        freq_bits = doc_bits + nblocks;
+        payloads  = buf + header_nbytes(nblocks);
+
+        assert(nblocks == (size + kBlock - 1) / kBlock and lasts[nblocks - 1] == bound);
+    }
+
+    uint32_t value() const
+    {
+        return value_;
+    }
+
+    size_t position() const
+    {
+        return position_;
+    }
+
+    uint32_t freq()
+    {
+        if (irg_unlikely(freq_block != block))
+        {
+            freq_block = block;
+            BP128::unpack<false>(payloads + offsets[block] + 16 * doc_bits[block], freq_bits[block], 0, freqs);
+        }
+
+        return 1u + freqs[position_ % kBlock];
+    }
+
+    bool next()
+    {
+        position_++;
+        if (irg_unlikely(position_ % kBlock == 0)) decode(position_ / kBlock);
+
+        value_ = values[position_ % kBlock];
+        return true;
+    }
+
+    bool skip(size_t n)
+    {
+        position_ += n;
+        if (position_ / kBlock != block) decode(position_ / kBlock);
+
+        value_ = values[position_ % kBlock];
+        return true;
+    }
+
+    bool skipTo(uint32_t v)
+    {
+        if (position_ != size_t(-1) and v <= value_) return true;
+
+        size_t i = position_ == size_t(-1) ? 0 : position_ % kBlock;
+
+        if (position_ == size_t(-1) or v > lasts[block])
+        {
+            size_t from = position_ == size_t(-1) ? 0 : block + 1;
+            decode(std::lower_bound(lasts + from, lasts + nblocks, v) - lasts);
+            i = 0;
+        }
+
+        while (values[i] < v) i++;
+
+        position_ = block * kBlock + i;
+        value_    = values[i];
+        return true;
+    }
+
+   private:
+    void decode(size_t b)
+    {
+        block = b;
+        BP128::unpack<true, true>(payloads + offsets[b], doc_bits[b], b ? lasts[b - 1] + 1 : 0, values);
+    }
+
+    const uint32_t* lasts     = nullptr;
+    const uint32_t* offsets   = nullptr;
+    const uint8_t*  doc_bits  = nullptr;
+    const uint8_t*  freq_bits = nullptr;
+    const uint8_t*  payloads  = nullptr;
+    size_t          nblocks   = 0;
+
+    size_t   block      = size_t(-1);
+    size_t   freq_block = size_t(-1);
+    size_t   position_  = size_t(-1);
+    uint32_t value_     = 0;
+
+    alignas(16) uint32_t values[kBlock];
+    alignas(16) uint32_t freqs[kBlock];
+};
+
+inline InterleavedCompression::Reader InterleavedCompression::reader(size_t bound, size_t size, const uint8_t* buf)
+{
+    return Reader(bound, size, buf);
+}
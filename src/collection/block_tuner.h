@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "collection/collection.h"
+#include "collection/index_file.h"
+#include "collection/sparse_bounds.h"
+
+/* Largest number of doc ranges (log2) a long list's block bound may cover: the range kernels handle 0 to 2. */
+constexpr uint32_t MaxBlockShift = 2;
+
+/* The fixed rule: a list of local_df postings keeps a bound per 1 << shift doc ranges. */
+uint32_t default_block_shift(uint32_t local_df)
+{
+    if (local_df < SparseRangeBounds::MaxDF) return 0;
+    return (local_df < (1 << 17)) + (local_df < (1 << 18));
+}
+
+/* Of the first nqueries lines of the query log, for keying what is tuned on it (0 if it cannot be read). */
+uint64_t query_log_fingerprint(const std::string &queries_path, uint32_t nqueries)
+{
+    std::ifstream queries_file(queries_path);
+    if (not queries_file) return 0;
+
+    std::string log, text;
+    for (auto q = 0u; q < nqueries and std::getline(queries_file, text); q++) log += text + '\n';
+
+    return index_checksum(reinterpret_cast<const uint8_t *>(log.data()), log.size());
+}
+
+/*
+ * Offline choice of each long list's block shift, by replaying the query log against this rank's index. For a
+ * query, the threshold is estimated by the TopK-th largest impact of its best term (a lower bound on the true
+ * one). A block of term t then survives if its bound, plus the other terms' bounds, exceeds the threshold. The
+ * shift minimizes, over the log, the bound entries scanned plus the postings of the surviving blocks.
+ *
+ * Each list is profiled in one pass: its bounds per doc range, combined for each shift into a histogram of the
+ * postings by block bound (in 1/255ths of the term bound).
+ */
+class BlockTuner
+{
+   public:
+    static constexpr uint32_t TopK           = 10;
+    static constexpr uint32_t NumBins        = 256;
+    static constexpr float    BoundCheckCost = 1.0f / 16; /* A lane of a SIMD add, relative to a scored posting. */
+
+    BlockTuner(Collection &C, RectangularMatrix<EdgeWeight> &A) : C(C), A(A)
+    {
+    }
+
+    /* Sets A.block_shifts: tuned for the long lists in the log, by default_block_shift() for the others. */
+    void tune(const std::string &queries_path, uint32_t nqueries)
+    {
+        A.block_shifts.resize(A.terms.size());
+        for (uint32_t i = 0; i < A.terms.size(); i++) A.block_shifts[i] = default_block_shift(A.terms[i].local_df);
+
+        read_queries(queries_path, nqueries);
+        profile();
+
+        /* Cost of each shift, per profiled term, over the log. */
+        std::vector<std::array<double, MaxBlockShift + 1>> costs(profiles.size());
+
+        for (auto &query : queries)
+        {
+            float threshold = 0.0f, sum = 0.0f;
+            for (auto idx : query)
+            {
+                threshold = std::max(threshold, kth_impacts[idx]);
+                sum += term_bounds[idx];
+            }
+
+            for (auto idx : query)
+            {
+                if (profile_of[idx] == UINT32_MAX or not(term_bounds[idx] > 0)) continue;
+
+                auto &p    = profiles[profile_of[idx]];
+                float rest = sum - term_bounds[idx];
+
+                /* Blocks whose bound (at bin b, up to b / 255 of the term bound) exceeds threshold - rest survive. */
+                float    x   = (threshold - rest) / term_bounds[idx] * (NumBins - 1);
+                uint32_t bin = x < 0 ? 0 : std::min(NumBins, uint32_t(std::floor(x)) + 1);
+
+                for (uint32_t s = 0; s <= MaxBlockShift; s++)
+                    costs[profile_of[idx]][s] += BoundCheckCost * p.nblocks[s] + p.surviving[s][bin];
+            }
+        }
+
+        size_t nchanged = 0;
+        for (uint32_t i = 0; i < A.terms.size(); i++)
+        {
+            if (profile_of[i] == UINT32_MAX) continue;
+
+            auto &c    = costs[profile_of[i]];
+            auto  best = uint8_t(std::min_element(c.begin(), c.end()) - c.begin());
+
+            nchanged += (best != A.block_shifts[i]);
+            A.block_shifts[i] = best;
+        }
+
+        LOG.info("Tuned the block sizes of %lu lists over %lu queries (%lu changed)\n", profiles.size(),
+                 queries.size(), nchanged);
+    }
+
+   private:
+    struct Profile
+    {
+        std::array<uint64_t, MaxBlockShift + 1> nblocks;
+
+        /* surviving[s][b]: the postings in blocks of bin >= b, at shift s (and 0 for b = NumBins). */
+        std::array<std::array<uint64_t, NumBins + 1>, MaxBlockShift + 1> surviving;
+    };
+
+    void read_queries(const std::string &queries_path, uint32_t nqueries)
+    {
+        std::ifstream queries_file(queries_path);
+        std::string   text, term;
+
+        for (auto q = 0u; q < nqueries and std::getline(queries_file, text); q++)
+        {
+            queries.emplace_back();
+
+            std::istringstream iss(text);
+            while (iss >> term)
+            {
+                uint32_t idx = C.term_label2idx(term);
+                if (idx != C.UNK and idx < A.terms.size()) queries.back().push_back(idx);
+            }
+        }
+    }
+
+    /* The term bound and TopK-th impact of every query term, and the profile of the long ones. */
+    void profile()
+    {
+        using UserTermStats = ChosenTerm2Doc::TermStats;
+
+        std::vector<bool> in_log(A.terms.size());
+        for (auto &query : queries)
+            for (auto idx : query) in_log[idx] = true;
+
+        std::vector<uint32_t> terms;
+        for (uint32_t i = 1; i < A.terms.size(); i++)
+            if (in_log[i]) terms.push_back(i);
+
+        profile_of.assign(A.terms.size(), UINT32_MAX);
+        for (auto i : terms)
+        {
+            if (A.terms[i].local_df < SparseRangeBounds::MaxDF) continue;
+
+            profile_of[i] = profiles.size();
+            profiles.emplace_back();
+        }
+
+        term_bounds.assign(A.terms.size(), 0.0f);
+        kth_impacts.assign(A.terms.size(), 0.0f);
+
+        auto         model = ChosenTerm2Doc(A.collection_stats);
+        DocIDsReader doc_ids_reader{A.doc_ids};
+
+        uint32_t nranges = 1 + (A.rank_ndocs >> SHARD_RADIX);
+
+#pragma omp parallel num_threads(8)
+        {
+            std::vector<float>    range_max;
+            std::vector<uint32_t> range_count;
+
+#pragma omp for schedule(dynamic, 1)
+            for (size_t k = 0; k < terms.size(); k++)
+            {
+                uint32_t i         = terms[k];
+                auto     reader    = doc_ids_reader.get_docs(i, A.terms[i].local_df);
+                auto     fiterator = doc_ids_reader.get_freqs(i, A.terms[i].local_df, A.terms[i].local_cf);
+
+                auto term_stats = UserTermStats(A.collection_stats, A.user_term_stats[i]);
+                auto term_bound = 0.0f;
+                bool long_list  = profile_of[i] != UINT32_MAX;
+
+                std::priority_queue<float, std::vector<float>, std::greater<float>> topk;
+
+                if (long_list)
+                {
+                    range_max.assign(nranges, 0.0f);
+                    range_count.assign(nranges, 0);
+                }
+
+                for (reader.next(); reader.value() < A.rank_ndocs; reader.next())
+                {
+                    uint32_t doc    = reader.value();
+                    float    impact = model.send(term_stats, fiterator.advance_and_read(), A.doc_stats[doc]);
+
+                    term_bound = std::max(term_bound, impact);
+
+                    if (topk.size() < TopK)
+                        topk.push(impact);
+                    else if (impact > topk.top())
+                    {
+                        topk.pop();
+                        topk.push(impact);
+                    }
+
+                    if (long_list)
+                    {
+                        uint32_t range     = doc >> SHARD_RADIX;
+                        range_max[range]   = std::max(range_max[range], impact);
+                        range_count[range] = range_count[range] + 1;
+                    }
+                }
+
+                term_bounds[i] = term_bound;
+                kth_impacts[i] = topk.size() == TopK ? topk.top() : 0.0f;
+
+                if (long_list) histogram(profiles[profile_of[i]], range_max, range_count, term_bound);
+            }
+        }
+    }
+
+    static void histogram(Profile &p, const std::vector<float> &range_max, const std::vector<uint32_t> &range_count,
+                          float term_bound)
+    {
+        for (uint32_t s = 0; s <= MaxBlockShift; s++)
+        {
+            auto &surviving = p.surviving[s];
+            surviving.fill(0);
+            p.nblocks[s] = 0;
+
+            for (size_t begin = 0; begin < range_max.size(); begin += (size_t(1) << s))
+            {
+                size_t   end   = std::min(range_max.size(), begin + (size_t(1) << s));
+                float    bound = 0.0f;
+                uint64_t count = 0;
+
+                for (size_t r = begin; r < end; r++)
+                {
+                    bound = std::max(bound, range_max[r]);
+                    count += range_count[r];
+                }
+
+                uint32_t bin = term_bound > 0 ? uint32_t(std::ceil(bound / term_bound * (NumBins - 1))) : 0;
+                surviving[std::min(bin, NumBins - 1)] += count;
+                p.nblocks[s]++;
+            }
+
+            for (int b = NumBins - 1; b >= 0; b--) surviving[b] += surviving[b + 1];
+        }
+    }
+
+    Collection &                   C;
+    RectangularMatrix<EdgeWeight> &A;
+
+    std::vector<std::vector<uint32_t>> queries;
+    std::vector<float>                 term_bounds;
+    std::vector<float>                 kth_impacts;
+    std::vector<uint32_t>              profile_of;
+    std::vector<Profile>               profiles;
+};
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <unistd.h>
+#include <cinttypes>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "collection/index_file.h"
+#include "collection/rectangular_matrix.h"
+
+#define BOUNDS_STRINGIFY_(x) #x
+#define BOUNDS_STRINGIFY(x) BOUNDS_STRINGIFY_(x)
+
+/* What the bounds computed by optimize_model() depend on; a cached file is only used for an identical key. */
+struct BoundsKey
+{
+    char     model[32]            = {};
+    uint64_t model_fingerprint    = 0; /* send() over a fixed grid of inputs: covers the model's parameters. */
+    uint64_t stats_fingerprint    = 0; /* The collection and (global) term statistics. */
+    uint64_t index_fingerprint    = 0; /* The stored checksums of the local index. */
+    uint64_t workload_fingerprint = 0; /* The query log the block sizes were tuned on (0 if untuned). */
+    uint32_t shard_radix          = SHARD_RADIX;
+    uint32_t layout               = 0; /* 0: doc ranges and blocks of postings, 2: VBMW partitions (1 is unused). */
+    float    vbmw_cost            = 0.0f;
+    /* Of the file: 2 saves FlatRows as laid out, 3 adds the pyramid, 4 BOUND_BITS, 5 bounds short lists by range,
+     * 6 bounds them sparsely, 7 adds the block shifts, 8 drops the float block bounds, 9 their pyramid rows,
+     * 10 has the bounds of both layouts. */
+    uint32_t format               = 10;
+    uint32_t pyramid_levels       = PYRAMID_LEVELS;
+    uint32_t pyramid_radix        = PYRAMID_RADIX;
+    uint32_t bound_bits           = BOUND_BITS;
+    uint32_t padding              = 0; /* Explicit, as memcmp compares it. */
+
+    bool operator==(const BoundsKey &other) const
+    {
+        return memcmp(this, &other, sizeof(BoundsKey)) == 0;
+    }
+};
+
+/*
+ * Per-rank, per-key cache of the term and doc bounds: <CachePrefix><rank>.bounds.<key hash>.bin, in the
+ * format of the index container. Loading it costs a checksum pass over the bounds rather than a pass over the
+ * postings, after which they are read in place from the mapping; files for other keys (e.g., another SHARD_RADIX
+ * or VBMW_COST) are left alone.
+ */
+class BoundsCache
+{
+   public:
+    using Message = RectangularMatrix<EdgeWeight>::Message;
+
+    BoundsCache(RectangularMatrix<EdgeWeight> &A, uint64_t workload_fingerprint = 0) : A(A)
+    {
+        make_key();
+        key.workload_fingerprint = workload_fingerprint;
+
+        char hash[17];
+        snprintf(hash, sizeof(hash), "%016" PRIx64, index_checksum(reinterpret_cast<const uint8_t *>(&key), sizeof(key)));
+        path = CachePrefix + std::to_string(Env::rank) + ".bounds." + hash + ".bin";
+    }
+
+    /* Fills A's bounds from the cache; false (with A untouched) if there is no usable file for this key. */
+    bool load()
+    {
+        if (access(path.c_str(), F_OK) != 0) return false;
+
+        /* The bounds are used in place (with CACHE_MMAP), so the file stays open for as long as A. */
+        IndexFile &file = A.bounds_file;
+
+        if (not usable(file))
+        {
+            file.close();
+            return false;
+        }
+
+        load_array(file, MAXSCORES, A.maxscores);
+        load_rows(file, QMAXSCORES, QMAXSCORES_ROWS, A.qmaxscores);
+        load_rows(file, BMW_QMAXSCORES, BMW_QMAXSCORES_ROWS, A.bmw_qmaxscores);
+        load_rows(file, DOC_MAXSCORES, DOC_MAXSCORES_ROWS, A.doc_maxscores);
+        load_rows(file, BMW_WDOC, BMW_WDOC_ROWS, A.bmw_wdoc);
+        load_rows(file, BMW_SDOC, BMW_SDOC_ROWS, A.bmw_sdoc);
+        load_rows(file, SPARSE_RANGES, SPARSE_RANGES_ROWS, A.sparse_bounds.ranges);
+        load_rows(file, SPARSE_CODES, SPARSE_CODES_ROWS, A.sparse_bounds.codes);
+        load_array(file, BLOCK_SHIFTS, A.block_shifts);
+        load_array(file, DOC_BOUNDS, A.doc_bounds);
+        load_array(file, DOC_MESSAGES, A.doc_messages);
+        A.global_doc_bound = file.value<decltype(A.global_doc_bound)>(GLOBAL_DOC_BOUND);
+
+        for (uint32_t l = 0; l < PYRAMID_LEVELS; l++)
+        {
+            load_rows(file, pyramid(PYRAMID_MAXSCORES, l), pyramid(PYRAMID_MAXSCORES_ROWS, l), A.pyramid_maxscores[l]);
+            load_array(file, pyramid(PYRAMID_DOC_BOUNDS, l), A.pyramid_doc_bounds[l]);
+        }
+
+#if not CACHE_MMAP
+        file.close();
+#endif
+
+        LOG.info("Loaded the bounds of %lu terms from %s\n", A.maxscores.size(), path.c_str());
+        return true;
+    }
+
+    void save()
+    {
+        IndexFileWriter writer(path);
+
+        writer.add_value(BOUNDS_KEY, key);
+        writer.add_array(MAXSCORES, A.maxscores.data(), A.maxscores.size());
+        add_rows(writer, QMAXSCORES, QMAXSCORES_ROWS, A.qmaxscores);
+        add_rows(writer, BMW_QMAXSCORES, BMW_QMAXSCORES_ROWS, A.bmw_qmaxscores);
+        add_rows(writer, DOC_MAXSCORES, DOC_MAXSCORES_ROWS, A.doc_maxscores);
+        add_rows(writer, BMW_WDOC, BMW_WDOC_ROWS, A.bmw_wdoc);
+        add_rows(writer, BMW_SDOC, BMW_SDOC_ROWS, A.bmw_sdoc);
+        add_rows(writer, SPARSE_RANGES, SPARSE_RANGES_ROWS, A.sparse_bounds.ranges);
+        add_rows(writer, SPARSE_CODES, SPARSE_CODES_ROWS, A.sparse_bounds.codes);
+        writer.add_array(BLOCK_SHIFTS, A.block_shifts.data(), A.block_shifts.size());
+        writer.add_array(DOC_BOUNDS, A.doc_bounds.data(), A.doc_bounds.size());
+        writer.add_array(DOC_MESSAGES, A.doc_messages.data(), A.doc_messages.size());
+        writer.add_value(GLOBAL_DOC_BOUND, A.global_doc_bound);
+
+        for (uint32_t l = 0; l < PYRAMID_LEVELS; l++)
+        {
+            add_rows(writer, pyramid(PYRAMID_MAXSCORES, l), pyramid(PYRAMID_MAXSCORES_ROWS, l), A.pyramid_maxscores[l]);
+            writer.add_array(pyramid(PYRAMID_DOC_BOUNDS, l), A.pyramid_doc_bounds[l].data(),
+                             A.pyramid_doc_bounds[l].size());
+        }
+
+        writer.write();
+    }
+
+   private:
+    /* Opens the file; false if it is not a complete, intact cache for this key, which is then recomputed. */
+    bool usable(IndexFile &file) const
+    {
+        if (const char *reason = file.try_open(path))
+        {
+            LOG.info("Unusable %s (%s), recomputing the bounds\n", path.c_str(), reason);
+            return false;
+        }
+
+        if (not file.has(BOUNDS_KEY) or file.section(BOUNDS_KEY).nbytes != sizeof(BoundsKey) or
+            file.section(BOUNDS_KEY).elem_size != sizeof(BoundsKey) or not(file.value<BoundsKey>(BOUNDS_KEY) == key))
+        {
+            LOG.info("%s was computed for other bounds, recomputing them\n", path.c_str());
+            return false;
+        }
+
+        std::vector<IndexSectionID> ids = {MAXSCORES, QMAXSCORES, QMAXSCORES_ROWS, BMW_QMAXSCORES, BMW_QMAXSCORES_ROWS,
+                                           DOC_MAXSCORES, DOC_MAXSCORES_ROWS, BMW_WDOC, BMW_WDOC_ROWS, BMW_SDOC,
+                                           BMW_SDOC_ROWS, DOC_BOUNDS, DOC_MESSAGES, GLOBAL_DOC_BOUND, SPARSE_RANGES,
+                                           SPARSE_RANGES_ROWS, SPARSE_CODES, SPARSE_CODES_ROWS, BLOCK_SHIFTS};
+
+        for (uint32_t l = 0; l < PYRAMID_LEVELS; l++)
+            for (auto id : {PYRAMID_MAXSCORES, PYRAMID_MAXSCORES_ROWS, PYRAMID_DOC_BOUNDS}) ids.push_back(pyramid(id, l));
+
+        for (auto id : ids)
+        {
+            if (not file.has(id) or not file.verify(id))
+            {
+                LOG.info("Missing or corrupt section %u in %s, recomputing the bounds\n", id, path.c_str());
+                return false;
+            }
+        }
+
+        bool rows_ok = rows_match(file, QMAXSCORES, QMAXSCORES_ROWS, A.qmaxscores) and
+                       rows_match(file, BMW_QMAXSCORES, BMW_QMAXSCORES_ROWS, A.bmw_qmaxscores) and
+                       rows_match(file, DOC_MAXSCORES, DOC_MAXSCORES_ROWS, A.doc_maxscores) and
+                       rows_match(file, BMW_WDOC, BMW_WDOC_ROWS, A.bmw_wdoc) and
+                       rows_match(file, BMW_SDOC, BMW_SDOC_ROWS, A.bmw_sdoc) and
+                       rows_match(file, SPARSE_RANGES, SPARSE_RANGES_ROWS, A.sparse_bounds.ranges) and
+                       rows_match(file, SPARSE_CODES, SPARSE_CODES_ROWS, A.sparse_bounds.codes);
+
+        for (uint32_t l = 0; l < PYRAMID_LEVELS; l++)
+            rows_ok = rows_ok and rows_match(file, pyramid(PYRAMID_MAXSCORES, l), pyramid(PYRAMID_MAXSCORES_ROWS, l),
+                                             A.pyramid_maxscores[l]);
+
+        if (not rows_ok)
+        {
+            LOG.info("Inconsistent rows in %s, recomputing the bounds\n", path.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    void make_key()
+    {
+        strncpy(key.model, BOUNDS_STRINGIFY(ChosenTerm2Doc), sizeof(key.model) - 1);
+
+        /* The model's scores on a fixed grid of term and doc statistics. */
+        auto                                 model = ChosenTerm2Doc(A.collection_stats);
+        std::vector<ChosenTerm2Doc::Message> probes;
+
+        for (uint32_t df : {1u, 10u, 1000u})
+        {
+            for (uint32_t len : {1u, 100u, 10000u})
+            {
+                ::TermStats    t = {std::min(df, A.collection_stats.ndocs), 4 * df};
+                StaticDocStats d = {len, len, 0.0f, 0.0f};
+
+                auto term_stats = ChosenTerm2Doc::TermStats(A.collection_stats, t);
+                auto doc_stats  = ChosenTerm2Doc::DocStats(A.collection_stats, d);
+
+                for (float tf : {1.0f, 3.0f, 30.0f}) probes.push_back(model.send(term_stats, tf, doc_stats));
+            }
+        }
+
+        key.model_fingerprint = fingerprint(probes.data(), probes.size());
+
+        uint64_t stats[] = {A.collection_stats.ndocs, A.collection_stats.nterms, A.collection_stats.ntokens,
+                            fingerprint(A.user_term_stats.data(), A.user_term_stats.size())};
+        key.stats_fingerprint = fingerprint(stats, 4);
+
+        /* The sections' checksums were computed when the index was written; nothing is read past its header. */
+        IndexFile index;
+        index.open(A.index_path());
+
+        std::vector<uint64_t> checksums;
+        for (auto id : {TERMS, DOC_STATS, DOCS, FREQS, DOCS_OFFSETS, FREQS_OFFSETS})
+            checksums.push_back(index.section(id).checksum);
+
+        key.index_fingerprint = fingerprint(checksums.data(), checksums.size());
+
+#if VBMW_BLOCKS
+        key.layout    = 2;
+        key.vbmw_cost = VBMW_COST;
+#endif
+    }
+
+    static_assert(PYRAMID_LEVELS <= 8, "The container has section IDs for 8 pyramid levels");
+
+    static IndexSectionID pyramid(IndexSectionID id, uint32_t level)
+    {
+        return IndexSectionID(id + 3 * level);
+    }
+
+    template <class T>
+    static uint64_t fingerprint(const T *data, size_t n)
+    {
+        return index_checksum(reinterpret_cast<const uint8_t *>(data), n * sizeof(T));
+    }
+
+    /* Rows are saved as they are laid out in memory, padding included. */
+    template <class T>
+    static void add_rows(IndexFileWriter &writer, IndexSectionID values_id, IndexSectionID rows_id,
+                         const FlatRows<T> &rows)
+    {
+        writer.add_array(values_id, rows.data(), rows.nvalues());
+        writer.add_array(rows_id, rows.row_ends(), rows.nrows());
+    }
+
+    template <class T>
+    static void load_array(const IndexFile &file, IndexSectionID id, MappedVector<T> &v)
+    {
+        size_t n;
+        T *    data = file.array<T>(id, n);
+
+#if CACHE_MMAP
+        v.view(data, n);
+#else
+        v.clear();
+        v.resize(n);
+        std::copy(data, data + n, v.begin());
+#endif
+    }
+
+    /* Whether the sections hold rows of T whose ends cover the values exactly. */
+    template <class T>
+    static bool rows_match(const IndexFile &file, IndexSectionID values_id, IndexSectionID rows_id, const FlatRows<T> &)
+    {
+        const IndexSection &values = file.section(values_id);
+        const IndexSection &rows   = file.section(rows_id);
+
+        if (values.elem_size != sizeof(T) or rows.elem_size != sizeof(uint64_t) or rows.nbytes % sizeof(uint64_t))
+            return false;
+
+        size_t    nrows;
+        uint64_t *ends = file.array<uint64_t>(rows_id, nrows);
+
+        return values.nbytes == (nrows ? ends[nrows - 1] : 0) * sizeof(T);
+    }
+
+    template <class T>
+    static void load_rows(const IndexFile &file, IndexSectionID values_id, IndexSectionID rows_id, FlatRows<T> &rows)
+    {
+        size_t    nrows, nvalues;
+        uint64_t *ends   = file.array<uint64_t>(rows_id, nrows);
+        T *       values = file.array<T>(values_id, nvalues);
+
+#if CACHE_MMAP
+        rows.view(ends, nrows, values, nvalues);
+#else
+        rows.assign(ends, nrows, values, nvalues);
+#endif
+    }
+
+    RectangularMatrix<EdgeWeight> &A;
+
+    BoundsKey   key;
+    std::string path;
+};
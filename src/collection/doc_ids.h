@@ -4,15 +4,21 @@
 #include <cassert>
 #include <vector>
 #include "api/bm25.h"
+#include "collection/block_codec.h"
+#include "collection/index_file.h"
+#include "collection/partitioned_ef.h"
 #include "collection/stats.h"
 #include "folly/EliasFano.h"
+#include "structures/chunked_arena.h"
 #include "structures/fixed_vector.h"
+#include "structures/mapped_vector.h"
 #include "tsl/sparse_map.h"
 #include "utils/common.h"
 #include "utils/dist_timer.h"
 
 #include <algorithm>
 #include <cstdlib>
+#include <cstring>
 #include <vector>
 
 // ds2i::optpfor_block; ds2i::varint_G8IU_block; ds2i::interpolative_block;
@@ -27,9 +33,13 @@ struct Compression
     using Layout  = typename Encoder::Layout;
     using Reader  = folly::compression::EliasFanoReader<Encoder, folly::compression::instructions::Default, true>;
 
+    /* Also zeroes the alignment padding, so the saved index does not depend on the build schedule. */
     static size_t encode(const std::vector<Value>& v, uint8_t* buf)
     {
-        return Encoder::encode_into_buffer(v.begin(), v.end(), v.back(), buf);
+        size_t bytes = Encoder::encode_into_buffer(v.begin(), v.end(), v.back(), buf);
+        memset(buf + nbytes(v.back(), v.size()), 0, bytes - nbytes(v.back(), v.size()));
+
+        return bytes;
     }
 
     static size_t nbytes(size_t bound, size_t size)
@@ -37,6 +47,15 @@ struct Compression
         return Layout::fromUpperBoundAndSize(bound, size).bytes();
     }
 
+    /* What encode() returns: the list plus its alignment padding. */
+    static size_t encoded_nbytes(size_t bound, size_t size)
+    {
+        size_t bytes     = nbytes(bound, size);
+        size_t alignment = std::max(sizeof(Value), sizeof(typename Encoder::SkipValueType));
+
+        return bytes + (alignment - bytes % alignment);
+    }
+
     static List list(size_t bound, size_t size, uint8_t* buf)
     {
         return Layout::fromUpperBoundAndSize(bound, size).fromList(buf);
@@ -48,15 +67,134 @@ struct Compression
     }
 };
 
-using DocCompression    = Compression<uint32_t>;
-using FreqCompression   = Compression<uint32_t, 0, 256>;
+/*
+ * Elias-Fano quanta of the posting lists (0 disables). Skip pointers (in doc IDs) make next_geq() sub-linear on
+ * long jumps; forward pointers (in positions) serve skip(), which is how EFWrapper::freq() catches up.
+ * They change the encoding, so they are recorded in the index and a cache built with other quanta is rejected.
+ * The defaults are those of caches written before the quanta were recorded (see PostingsCodec::legacy()), which
+ * thus stay usable; e.g., -DDOCS_SKIP_QUANTUM=128 opts into doc ID skips, at the cost of a rebuild.
+ */
+#ifndef DOCS_SKIP_QUANTUM
+#define DOCS_SKIP_QUANTUM 0
+#endif
+
+#ifndef DOCS_FORWARD_QUANTUM
+#define DOCS_FORWARD_QUANTUM 0
+#endif
+
+#ifndef FREQS_SKIP_QUANTUM
+#define FREQS_SKIP_QUANTUM 0
+#endif
+
+#ifndef FREQS_FORWARD_QUANTUM
+#define FREQS_FORWARD_QUANTUM 256
+#endif
+
+/*
+ * Alternatives to plain Elias-Fano, chosen at build time:
+ *   DOCS_PARTITIONED: doc IDs as partitioned Elias-Fano (see partitioned_ef.h), whose chunks use
+ *                     DOCS_SKIP_QUANTUM; DOCS_FORWARD_QUANTUM does not apply.
+ *   DOCS_BLOCKED, FREQS_BLOCKED: 128-posting SIMD bit-packed blocks (see block_codec.h), for lists that are
+ *                     traversed almost exhaustively; the quanta do not apply.
+ *   POSTINGS_INTERLEAVED: the blocks of both, interleaved in the docs (see InterleavedCompression), so that
+ *                     scoring a posting needs no second cursor; FREQS is left empty.
+ */
+#ifndef DOCS_PARTITIONED
+#define DOCS_PARTITIONED false
+#endif
+
+#ifndef DOCS_BLOCKED
+#define DOCS_BLOCKED false
+#endif
+
+#ifndef FREQS_BLOCKED
+#define FREQS_BLOCKED false
+#endif
+
+#ifndef POSTINGS_INTERLEAVED
+#define POSTINGS_INTERLEAVED false
+#endif
+
+#if DOCS_PARTITIONED and DOCS_BLOCKED
+#error "DOCS_PARTITIONED and DOCS_BLOCKED are exclusive"
+#endif
+
+#if POSTINGS_INTERLEAVED and (DOCS_PARTITIONED or DOCS_BLOCKED or FREQS_BLOCKED)
+#error "POSTINGS_INTERLEAVED sets the codec of both docs and freqs"
+#endif
+
+enum PostingsCodecID : uint32_t
+{
+    EF_CODEC             = 0,
+    PARTITIONED_EF_CODEC = 1,
+    BLOCK_CODEC          = 2,
+    INTERLEAVED_CODEC    = 3,
+};
+
+#if POSTINGS_INTERLEAVED
+using DocCompression = InterleavedCompression;
+#define DOCS_CODEC INTERLEAVED_CODEC
+#elif DOCS_PARTITIONED
+using DocCompression = PartitionedCompression<uint32_t, DOCS_SKIP_QUANTUM>;
+#define DOCS_CODEC PARTITIONED_EF_CODEC
+#elif DOCS_BLOCKED
+using DocCompression = BlockCompression<uint32_t, true>;
+#define DOCS_CODEC BLOCK_CODEC
+#else
+using DocCompression = Compression<uint32_t, DOCS_SKIP_QUANTUM, DOCS_FORWARD_QUANTUM>;
+#define DOCS_CODEC EF_CODEC
+#endif
+
+/* Freqs are stored as prefix sums of (freq - 1), hence non-decreasing (unless interleaved with the docs). */
+#if POSTINGS_INTERLEAVED
+using FreqCompression = InterleavedCompression;
+#define FREQS_CODEC INTERLEAVED_CODEC
+#elif FREQS_BLOCKED
+using FreqCompression = BlockCompression<uint32_t, false>;
+#define FREQS_CODEC BLOCK_CODEC
+#else
+using FreqCompression = Compression<uint32_t, FREQS_SKIP_QUANTUM, FREQS_FORWARD_QUANTUM>;
+#define FREQS_CODEC EF_CODEC
+#endif
+
 using OffsetCompression = Compression<uint64_t, 0, 4096>;
 
+/* The codecs an index was encoded with (the CODEC section). */
+struct PostingsCodec
+{
+    uint32_t docs_skip_quantum;
+    uint32_t docs_forward_quantum;
+    uint32_t freqs_skip_quantum;
+    uint32_t freqs_forward_quantum;
+    uint32_t docs_codec;
+    uint32_t freqs_codec;
+
+    static PostingsCodec compiled()
+    {
+        return {DOCS_SKIP_QUANTUM, DOCS_FORWARD_QUANTUM, FREQS_SKIP_QUANTUM, FREQS_FORWARD_QUANTUM, DOCS_CODEC,
+                FREQS_CODEC};
+    }
+
+    /* Caches written before the codecs were configurable. */
+    static PostingsCodec legacy()
+    {
+        return {0, 0, 0, 256, EF_CODEC, EF_CODEC};
+    }
+
+    bool operator==(const PostingsCodec& other) const
+    {
+        return docs_skip_quantum == other.docs_skip_quantum and docs_forward_quantum == other.docs_forward_quantum and
+               freqs_skip_quantum == other.freqs_skip_quantum and freqs_forward_quantum == other.freqs_forward_quantum and
+               docs_codec == other.docs_codec and freqs_codec == other.freqs_codec;
+    }
+};
+
 struct FreqIterator
 {
     FreqCompression::Reader reader;
 
-    FreqIterator(const FreqCompression::Encoder::CompressedList& x) : reader(x)
+    /* With POSTINGS_INTERLEAVED, a cursor of its own over the docs, read for the freqs only. */
+    FreqIterator(const FreqCompression::Reader& x) : reader(x)
     {
         reader.next();
     }
@@ -67,6 +205,15 @@ struct FreqIterator
         if (irg_likely(curr < pos)) reader.skip(pos - curr);
     }
 
+#if POSTINGS_INTERLEAVED
+    uint32_t advance_and_read()
+    {
+        uint32_t freq = reader.freq();
+        reader.next();
+
+        return freq;
+    }
+#else
     uint32_t advance_and_read()
     {
         uint32_t prev = reader.value();
@@ -74,12 +221,28 @@ struct FreqIterator
 
         return 1u + reader.value() - prev;
     }
+#endif
 };
 
-class DocIDs
+/* One term's postings, in place in the input (see PostingStream). */
+struct PostingSpan
+{
+    const uint32_t* docs;
+    const uint32_t* freqs;
+    uint32_t        term;
+    uint32_t        df;
+    uint32_t        cf;
+};
+
+/* Where a term's compressed docs and freqs start; indexed by compressed term idx. */
+struct PostingsOffsets
 {
-    using WTriple = Triple<EdgeWeight>;
+    uint64_t docs;
+    uint64_t freqs;
+};
 
+class DocIDs
+{
    public:
     const DocID rank_ndocs;
 
@@ -88,37 +251,63 @@ class DocIDs
     uint8_t* docs_offsets  = nullptr;
     uint8_t* freqs_offsets = nullptr;
 
-    DocIDs(const DocID rank_ndocs, uint64_t ub_rank_ntriples) : rank_ndocs(rank_ndocs)
+    /* Dense copy of the two offset lists above, for constant-time cursor setup. */
+    MappedVector<PostingsOffsets> directory;
+
+    DocIDs(const DocID rank_ndocs) : rank_ndocs(rank_ndocs)
     {
         tmp_doc_offsets.push_back(0);
         tmp_freq_offsets.push_back(0);
-
-        docs = static_cast<uint8_t*>(malloc(uint64_t(5) * ub_rank_ntriples / 4));  // FIXME: !!
-        if (not docs) Env::exit(1);
-
-        freqs = static_cast<uint8_t*>(malloc(uint64_t(3) * ub_rank_ntriples / 4));
-        if (not freqs) Env::exit(1);
     }
 
-    void add_term(const std::vector<WTriple>& triples)
+    /*
+     * Encodes a batch of terms on all threads. The encoded size of every list is known before encoding it, so
+     * the offsets are laid out first (in term order) and each thread encodes straight into place: the batch's
+     * bytes are taken, exactly, from the docs and freqs arenas.
+     */
+    void add_terms(const std::vector<PostingSpan>& batch)
     {
-        size_t nbytes;
-
-        /* Compress Doc IDs. */
-        tmp_docs.clear();
-        for (auto& triple : triples) tmp_docs.push_back(triple.doc);
-        tmp_docs.push_back(rank_ndocs);
-
-        nbytes = DocCompression::encode(tmp_docs, docs + tmp_doc_offsets.back());
-        tmp_doc_offsets.push_back(tmp_doc_offsets.back() + nbytes);
-
-        /* Compress Doc Freqs. */
-        tmp_docs.clear();
-        tmp_docs.push_back(0);
-        for (auto& triple : triples) tmp_docs.push_back(tmp_docs.back() + triple.weight - 1);
-
-        nbytes = FreqCompression::encode(tmp_docs, freqs + tmp_freq_offsets.back());
-        tmp_freq_offsets.push_back(tmp_freq_offsets.back() + nbytes);
+        size_t base = tmp_doc_offsets.size() - 1;
+
+        tmp_doc_offsets.resize(base + 1 + batch.size());
+        tmp_freq_offsets.resize(base + 1 + batch.size());
+
+        /* Sizes (partitioned and blocked lists must be encoded to know theirs), then offsets. */
+#pragma omp parallel
+        {
+            std::vector<uint32_t> tmp, tmp_freqs;
+
+#pragma omp for schedule(dynamic, 64)
+            for (size_t i = 0; i < batch.size(); i++)
+            {
+                tmp_doc_offsets[base + 1 + i]  = encoded_docs_nbytes(batch[i], tmp, tmp_freqs);
+                tmp_freq_offsets[base + 1 + i] = encoded_freqs_nbytes(batch[i], tmp);
+            }
+        }
+
+        for (size_t i = base + 1; i < tmp_doc_offsets.size(); i++)
+        {
+            tmp_doc_offsets[i] += tmp_doc_offsets[i - 1];
+            tmp_freq_offsets[i] += tmp_freq_offsets[i - 1];
+        }
+
+        if (batch.empty()) return;
+
+        uint8_t* batch_docs  = docs_arena.allocate(tmp_doc_offsets.back() - tmp_doc_offsets[base]);
+        uint8_t* batch_freqs = freqs_arena.allocate(tmp_freq_offsets.back() - tmp_freq_offsets[base]);
+        if (not batch_docs or not batch_freqs) Env::exit(1);
+
+#pragma omp parallel
+        {
+            std::vector<uint32_t> tmp, tmp_freqs;
+
+#pragma omp for schedule(dynamic, 1)
+            for (size_t i = 0; i < batch.size(); i++)
+            {
+                encode_term(batch[i], tmp, tmp_freqs, batch_docs + (tmp_doc_offsets[base + i] - tmp_doc_offsets[base]),
+                            batch_freqs + (tmp_freq_offsets[base + i] - tmp_freq_offsets[base]));
+            }
+        }
     }
 
     void finalize()
@@ -127,25 +316,95 @@ class DocIDs
         docs_nbytes  = tmp_doc_offsets.back();
         freqs_nbytes = tmp_freq_offsets.back();
 
+        /* Compact the postings into exactly-sized buffers (plus the EF read slack). */
+        assert(docs_arena.size() == docs_nbytes and freqs_arena.size() == freqs_nbytes);
+
+        docs = docs_arena.compact(7);
+        if (not docs) Env::exit(1);
+
+        freqs = freqs_arena.compact(7);
+        if (not freqs) Env::exit(1);
+
         /* Finalize Doc IDs. */
-        docs_offsets = static_cast<uint8_t*>(malloc(uint64_t(4) * tmp_doc_offsets.size()));
+        docs_offsets = static_cast<uint8_t*>(calloc(tmp_doc_offsets.size(), 4));
         if (not docs_offsets) Env::exit(1);
 
         docs_offsets_nbytes = OffsetCompression::encode(tmp_doc_offsets, docs_offsets);
-        tmp_doc_offsets.clear();
 
         /* Finalize Doc Freqs. */
-        freqs_offsets = static_cast<uint8_t*>(malloc(uint64_t(4) * tmp_freq_offsets.size()));
+        freqs_offsets = static_cast<uint8_t*>(calloc(tmp_freq_offsets.size(), 4));
         if (not freqs_offsets) Env::exit(1);
 
         freqs_offsets_nbytes = OffsetCompression::encode(tmp_freq_offsets, freqs_offsets);
+
+        directory.resize(nterms);
+        for (size_t i = 0; i < nterms; i++) directory[i] = {tmp_doc_offsets[i], tmp_freq_offsets[i]};
+
+        tmp_doc_offsets.clear();
         tmp_freq_offsets.clear();
 
         // LOG.info("Document IDs use up %.2f GiBs\n", docs_nbytes / 1024.0 / 1024.0 / 1024.0);
         // LOG.info("Term Postings Offsets use up %.2f GiBs\n", offsets_nbytes / 1024.0 / 1024.0 / 1024.0);
     }
 
-    void load()
+    void load(const IndexFile& index)
+    {
+        check_codec(index.has(CODEC) ? index.value<PostingsCodec>(CODEC) : PostingsCodec::legacy());
+
+        nterms               = index.value<size_t>(DOCS_NTERMS);
+        docs_nbytes          = index.section(DOCS).nbytes;
+        freqs_nbytes         = index.section(FREQS).nbytes;
+        docs_offsets_nbytes  = index.section(DOCS_OFFSETS).nbytes;
+        freqs_offsets_nbytes = index.section(FREQS_OFFSETS).nbytes;
+
+#if CACHE_MMAP
+        /* Zero-copy: postings and their offsets are used in place from the mapped container. */
+        docs          = index.data(DOCS);
+        freqs         = index.data(FREQS);
+        docs_offsets  = index.data(DOCS_OFFSETS);
+        freqs_offsets = index.data(FREQS_OFFSETS);
+
+        /* Offsets are walked for every cursor; postings are only touched for the terms being queried. */
+        index.advise(DOCS_OFFSETS, MADV_WILLNEED);
+        index.advise(FREQS_OFFSETS, MADV_WILLNEED);
+
+        if (index.has(DIRECTORY))
+        {
+            size_t           n;
+            PostingsOffsets* directory_ = index.array<PostingsOffsets>(DIRECTORY, n);
+            directory.view(directory_, n);
+            index.advise(DIRECTORY, MADV_WILLNEED);
+        }
+#else
+        docs          = index.copy(DOCS);
+        freqs         = index.copy(FREQS);
+        docs_offsets  = index.copy(DOCS_OFFSETS);
+        freqs_offsets = index.copy(FREQS_OFFSETS);
+
+        if (index.has(DIRECTORY))
+        {
+            size_t           n;
+            PostingsOffsets* directory_ = index.array<PostingsOffsets>(DIRECTORY, n);
+            directory.resize(n);
+            std::copy(directory_, directory_ + n, directory.begin());
+        }
+#endif
+
+        /* Containers written before the directory existed. */
+        if (not index.has(DIRECTORY)) build_directory();
+
+        if (directory.size() != nterms)
+        {
+            LOG.info("Postings directory has %lu entries, expected %lu\n", directory.size(), nterms);
+            Env::exit(1);
+        }
+
+        LOG.info("Loaded %.2f GiBs of docs and %.2f GiBs of freqs\n", docs_nbytes / 1024.0 / 1024.0 / 1024.0,
+                 freqs_nbytes / 1024.0 / 1024.0 / 1024.0);
+    }
+
+    /* NOTE: Reads the loose per-file cache written before the index container existed. */
+    void load_legacy()
     {
         struct stat st;
         std::string s;
@@ -153,6 +412,8 @@ class DocIDs
         size_t      r;
         std::string prefix{CachePrefix};
 
+        check_codec(PostingsCodec::legacy());
+
         s = prefix + std::to_string(Env::rank) + ".docs.bin";
         f = fopen(s.c_str(), "r");
         assert(f != NULL);
@@ -161,7 +422,8 @@ class DocIDs
 
         LOG.info("NEW docs_nbyts = %lu\n", docs_nbytes);
 
-        r = fread(docs, docs_nbytes, 1, f);
+        docs = static_cast<uint8_t*>(malloc(docs_nbytes + 7));
+        r    = fread(docs, docs_nbytes, 1, f);
         assert(r == 1);
         fclose(f);
 
@@ -170,6 +432,7 @@ class DocIDs
         assert(f != NULL);
         stat(s.c_str(), &st);
         freqs_nbytes = st.st_size;
+        freqs        = static_cast<uint8_t*>(malloc(freqs_nbytes + 7));
         r            = fread(freqs, freqs_nbytes, 1, f);
         assert(r == 1);
         fclose(f);
@@ -204,44 +467,49 @@ class DocIDs
         r = fread(&nterms, sizeof(nterms), 1, f);
         assert(r == 1);
         fclose(f);
+
+        build_directory();
     }
 
-    /* NOTE: Must be preceded by call to finalize() to be useful! */
-    void save()
+    /* Frees what load_legacy() read, once saved to the container that replaces it. */
+    void release_legacy()
     {
-        std::string prefix{CachePrefix};
-
-        LOG.info("OLD docs_nbyts = %lu\n", docs_nbytes);
-
-        FILE* f = fopen((prefix + std::to_string(Env::rank) + ".docs.bin").c_str(), "w");
-        assert(f != NULL);
-        size_t r = fwrite(docs, docs_nbytes, 1, f);
-        assert(r == 1);
-        fclose(f);
+        for (uint8_t** buf : {&docs, &freqs, &docs_offsets, &freqs_offsets})
+        {
+            free(*buf);
+            *buf = nullptr;
+        }
 
-        f = fopen((prefix + std::to_string(Env::rank) + ".freqs.bin").c_str(), "w");
-        assert(f != NULL);
-        r = fwrite(freqs, freqs_nbytes, 1, f);
-        assert(r == 1);
-        fclose(f);
-
-        f = fopen((prefix + std::to_string(Env::rank) + ".docs_offsets.bin").c_str(), "w");
-        assert(f != NULL);
-        r = fwrite(docs_offsets, docs_offsets_nbytes, 1, f);
-        assert(r == 1);
-        fclose(f);
+        directory.clear();
+    }
 
-        f = fopen((prefix + std::to_string(Env::rank) + ".freqs_offsets.bin").c_str(), "w");
-        assert(f != NULL);
-        r = fwrite(freqs_offsets, freqs_offsets_nbytes, 1, f);
-        assert(r == 1);
-        fclose(f);
+    /* Decodes both offset lists into the directory (one sequential pass). */
+    void build_directory()
+    {
+        OffsetCompression::Reader docs_offsets_reader  = get_docs_offsets_reader();
+        OffsetCompression::Reader freqs_offsets_reader = get_freqs_offsets_reader();
+
+        directory.clear();
+        directory.resize(nterms);
+
+        for (size_t i = 0; i < nterms; i++)
+        {
+            docs_offsets_reader.next();
+            freqs_offsets_reader.next();
+            directory[i] = {docs_offsets_reader.value(), freqs_offsets_reader.value()};
+        }
+    }
 
-        f = fopen((prefix + std::to_string(Env::rank) + ".docs_nterms.bin").c_str(), "w");
-        assert(f != NULL);
-        r = fwrite(&nterms, sizeof(nterms), 1, f);
-        assert(r == 1);
-        fclose(f);
+    /* NOTE: Must be preceded by call to finalize() (or load) to be useful! */
+    void save(IndexFileWriter& writer) const
+    {
+        writer.add(DOCS, docs, docs_nbytes);
+        writer.add(FREQS, freqs, freqs_nbytes);
+        writer.add(DOCS_OFFSETS, docs_offsets, docs_offsets_nbytes);
+        writer.add(FREQS_OFFSETS, freqs_offsets, freqs_offsets_nbytes);
+        writer.add_value(DOCS_NTERMS, nterms);
+        writer.add_array(DIRECTORY, directory.data(), directory.size());
+        writer.add_value(CODEC, codec);
     }
 
    public:
@@ -256,6 +524,98 @@ class DocIDs
     }
 
    private:
+    /* The postings can only be decoded with the codecs they were encoded with. */
+    static void check_codec(const PostingsCodec& found)
+    {
+        const PostingsCodec expected = PostingsCodec::compiled();
+        if (found == expected) return;
+
+        LOG.info("Index was encoded with docs=(codec %u, %u, %u) freqs=(codec %u, %u, %u), but this build uses "
+                 "docs=(codec %u, %u, %u) freqs=(codec %u, %u, %u); rebuild it with CACHE_REUSE false\n",
+                 found.docs_codec, found.docs_skip_quantum, found.docs_forward_quantum, found.freqs_codec,
+                 found.freqs_skip_quantum, found.freqs_forward_quantum, expected.docs_codec,
+                 expected.docs_skip_quantum, expected.docs_forward_quantum, expected.freqs_codec,
+                 expected.freqs_skip_quantum, expected.freqs_forward_quantum);
+        Env::exit(1);
+    }
+
+    /* A term's doc IDs as they are encoded: followed by rank_ndocs, which ends every list. */
+    const std::vector<uint32_t>& doc_list(const PostingSpan& t, std::vector<uint32_t>& tmp) const
+    {
+        tmp.assign(t.docs, t.docs + t.df);
+        tmp.push_back(rank_ndocs);
+
+        return tmp;
+    }
+
+    /* A term's freqs as they are encoded: prefix sums of (freq - 1), from 0. */
+    const std::vector<uint32_t>& freq_list(const PostingSpan& t, std::vector<uint32_t>& tmp) const
+    {
+        tmp.clear();
+        tmp.push_back(0);
+        for (uint32_t i = 0; i < t.df; i++) tmp.push_back(tmp.back() + t.freqs[i] - 1);
+
+        return tmp;
+    }
+
+    /* A term's freqs as they are interleaved: freq - 1 of each doc, 0 for the rank_ndocs that ends the list. */
+    const std::vector<uint32_t>& freq_gaps(const PostingSpan& t, std::vector<uint32_t>& tmp) const
+    {
+        tmp.clear();
+        for (uint32_t i = 0; i < t.df; i++) tmp.push_back(t.freqs[i] - 1);
+        tmp.push_back(0);
+
+        return tmp;
+    }
+
+    size_t encoded_docs_nbytes(const PostingSpan& t, std::vector<uint32_t>& tmp, std::vector<uint32_t>& tmp_freqs) const
+    {
+#if POSTINGS_INTERLEAVED
+        return DocCompression::encoded_nbytes(doc_list(t, tmp), freq_gaps(t, tmp_freqs));
+#elif DOCS_PARTITIONED or DOCS_BLOCKED
+        return DocCompression::encoded_nbytes(doc_list(t, tmp));
+#else
+        return DocCompression::encoded_nbytes(rank_ndocs, t.df + 1);
+#endif
+    }
+
+    size_t encoded_freqs_nbytes(const PostingSpan& t, std::vector<uint32_t>& tmp) const
+    {
+#if POSTINGS_INTERLEAVED
+        return 0;
+#elif FREQS_BLOCKED
+        return FreqCompression::encoded_nbytes(freq_list(t, tmp));
+#else
+        return FreqCompression::encoded_nbytes(t.cf - t.df, t.df + 1);
+#endif
+    }
+
+    /* Encodes one term into buf_docs and buf_freqs, which hold exactly its encoded sizes. */
+    void encode_term(const PostingSpan& t, std::vector<uint32_t>& tmp, std::vector<uint32_t>& tmp_freqs,
+                     uint8_t* buf_docs, uint8_t* buf_freqs)
+    {
+        size_t nbytes;
+
+#if POSTINGS_INTERLEAVED
+        /* Compress Doc IDs and Doc Freqs, together. */
+        nbytes = DocCompression::encode(doc_list(t, tmp), freq_gaps(t, tmp_freqs), buf_docs);
+        assert(nbytes == encoded_docs_nbytes(t, tmp, tmp_freqs));
+        (void)buf_freqs;
+#else
+        /* Compress Doc IDs. */
+        nbytes = DocCompression::encode(doc_list(t, tmp), buf_docs);
+        assert(nbytes == encoded_docs_nbytes(t, tmp, tmp_freqs));
+
+        /* Compress Doc Freqs. */
+        nbytes = FreqCompression::encode(freq_list(t, tmp), buf_freqs);
+        assert(nbytes == encoded_freqs_nbytes(t, tmp));
+#endif
+
+        (void)nbytes; /* Checked in debug builds only: the buffers were sized by the same functions. */
+    }
+
+    const PostingsCodec codec = PostingsCodec::compiled();
+
     size_t docs_offsets_nbytes  = 0;
     size_t freqs_offsets_nbytes = 0;
 
@@ -263,7 +623,8 @@ class DocIDs
     size_t docs_nbytes  = 0;
     size_t freqs_nbytes = 0;
 
-    std::vector<uint32_t> tmp_docs;
+    ChunkedArena          docs_arena;
+    ChunkedArena          freqs_arena;
     std::vector<size_t>   tmp_doc_offsets;
     std::vector<size_t>   tmp_freq_offsets;
 };
@@ -271,45 +632,22 @@ class DocIDs
 class DocIDsReader
 {
    public:
-    DocIDsReader(const DocIDs& D)
-        : docs(D.docs),
-          freqs(D.freqs),
-          rank_ndocs(D.rank_ndocs),
-          docs_offsets_reader(D.get_docs_offsets_reader()),
-          freqs_offsets_reader(D.get_freqs_offsets_reader())
+    DocIDsReader(const DocIDs& D) : docs(D.docs), freqs(D.freqs), rank_ndocs(D.rank_ndocs), directory(D.directory.data())
     {
     }
 
-    DocCompression::Reader get_docs(uint32_t compressed_term_idx, uint32_t df)
+    DocCompression::Reader get_docs(uint32_t compressed_term_idx, uint32_t df) const
     {
-        docs_offsets_reader.reset();
-        docs_offsets_reader.next();
-
-        assert(compressed_term_idx < docs_offsets_reader.size());
-
-        if (compressed_term_idx > docs_offsets_reader.position())
-            docs_offsets_reader.skip(compressed_term_idx - docs_offsets_reader.position());
-
-        assert(docs_offsets_reader.valid());
-        assert(docs_offsets_reader.position() == compressed_term_idx);
-
-        return DocCompression::reader(rank_ndocs, df + 1, docs + docs_offsets_reader.value());
+        return DocCompression::reader(rank_ndocs, df + 1, docs + directory[compressed_term_idx].docs);
     }
 
-    FreqIterator get_freqs(uint32_t compressed_term_idx, uint32_t df, uint64_t cf)
+    FreqIterator get_freqs(uint32_t compressed_term_idx, uint32_t df, uint64_t cf) const
     {
-        freqs_offsets_reader.reset();
-        freqs_offsets_reader.next();
-
-        assert(compressed_term_idx < freqs_offsets_reader.size());
-
-        if (compressed_term_idx > freqs_offsets_reader.position())
-            freqs_offsets_reader.skip(compressed_term_idx - freqs_offsets_reader.position());
-
-        assert(freqs_offsets_reader.valid());
-        assert(freqs_offsets_reader.position() == compressed_term_idx);
-
-        return FreqIterator(FreqCompression::list(cf - df, df + 1, freqs + freqs_offsets_reader.value()));
+#if POSTINGS_INTERLEAVED
+        return FreqIterator(FreqCompression::reader(rank_ndocs, df + 1, docs + directory[compressed_term_idx].docs));
+#else
+        return FreqIterator(FreqCompression::reader(cf - df, df + 1, freqs + directory[compressed_term_idx].freqs));
+#endif
     }
 
    private:
@@ -317,20 +655,48 @@ class DocIDsReader
     uint8_t*    freqs = nullptr;
     const DocID rank_ndocs;
 
-    OffsetCompression::Reader docs_offsets_reader;
-    OffsetCompression::Reader freqs_offsets_reader;
+    const PostingsOffsets* directory = nullptr;
 };
 
+#if TRACE_NEXT_GEQ
+/* One next_geq() call that moved a cursor: its term, where the cursor was and where it was sent. */
+struct NextGeqCall
+{
+    uint32_t term;
+    uint32_t from;
+    uint32_t target;
+};
+
+inline std::vector<NextGeqCall>& next_geq_trace()
+{
+    static std::vector<NextGeqCall> trace;
+    return trace;
+}
+#endif
+
 class EFWrapper
 {
    public:
     DocCompression::Reader reader;
-    FreqIterator           fiterator;
+#if not POSTINGS_INTERLEAVED
+    FreqIterator fiterator;
+#endif
+
+#if TRACE_NEXT_GEQ
+    uint32_t idx;
+#endif
 
     EFWrapper(DocIDsReader& doc_ids, uint32_t idx, uint32_t local_df, uint32_t local_cf)
-        : reader(doc_ids.get_docs(idx, local_df)), fiterator(doc_ids.get_freqs(idx, local_df, local_cf))
+        : reader(doc_ids.get_docs(idx, local_df))
+#if not POSTINGS_INTERLEAVED
+        , fiterator(doc_ids.get_freqs(idx, local_df, local_cf))
+#endif
     {
         reader.next();
+
+#if TRACE_NEXT_GEQ
+        this->idx = idx;
+#endif
     }
 
     uint32_t docid()
@@ -340,6 +706,9 @@ class EFWrapper
 
     uint32_t freq()
     {
+#if POSTINGS_INTERLEAVED
+        return reader.freq();
+#else
         uint32_t pos  = reader.position();
         uint32_t curr = fiterator.reader.position();
         if (curr < pos) fiterator.reader.skip(pos - curr);
@@ -350,6 +719,7 @@ class EFWrapper
         assert(fiterator.reader.value() >= prev);
 
         return 1u + fiterator.reader.value() - prev;
+#endif
     }
 
     void next()
@@ -359,6 +729,10 @@ class EFWrapper
 
     void next_geq(uint32_t doc)
     {
+#if TRACE_NEXT_GEQ
+        if (doc > reader.value()) next_geq_trace().push_back({idx, uint32_t(reader.value()), doc});
+#endif
+
         reader.skipTo(doc);
     }
 };
@@ -36,7 +36,7 @@ class Graph
 
     Graph(EdgeListArgs args, const std::vector<bool> &needed_terms);
 
-    uint64_t open_edge_lists();
+    void     open_edge_lists();
     void     read_edge_lists();
 };
 
@@ -6,6 +6,7 @@
 #include <cstdlib>
 #include <vector>
 
+#include "collection/posting_stream.h"
 #include "graph.h"
 #include "utils/common.h"
 #include "utils/dist_timer.h"
@@ -18,8 +19,10 @@ Graph<Weight>::Graph(EdgeListArgs args, const std::vector<bool> &needed_terms)
       nterms(args.nterms + 1), /* for one-based numbering, having a dummy term 0 */
       doc_shard_offsets(args.doc_shard_offsets),
       needed_terms(needed_terms),
-      A(ndocs, rank_ndocs, nterms, open_edge_lists())
+      A(ndocs, rank_ndocs, nterms)
 {
+    open_edge_lists();
+
     if (not CACHE_REUSE) read_edge_lists();
 
     for (auto f : files) fclose(f);
@@ -28,7 +31,7 @@ Graph<Weight>::Graph(EdgeListArgs args, const std::vector<bool> &needed_terms)
 }
 
 template <class Weight>
-uint64_t Graph<Weight>::open_edge_lists()
+void Graph<Weight>::open_edge_lists()
 {
     std::string prefix{GlobalPrefix};
     std::string suffix{".edges.bin"};
@@ -62,8 +65,6 @@ uint64_t Graph<Weight>::open_edge_lists()
 
     LOG.info("Files appear to have %lu edges (%u-byte weights).\n", nedges, sizeof(WTriple) - sizeof(Triple<Empty>));
     LOG.info("Relevant terms can have at most %lu edges.\n", ub_rank_ntriples);
-
-    return ub_rank_ntriples;
 }
 
 template <class Weight>
@@ -71,39 +72,48 @@ void Graph<Weight>::read_edge_lists()
 {
     LOG.info("Reading input files ...\n");
 
-    std::vector<WTriple> buffer;
+    /*
+     * Postings arrive grouped by term and sorted by doc, so terms are taken in place from the mapped input.
+     * This thread reads a batch of terms (about BatchPostings postings), which are then encoded on all
+     * threads; memory stays at the batch being encoded plus the read-ahead window.
+     */
+    constexpr uint64_t BatchPostings = uint64_t(1) << 26;
 
-    uint64_t             offset      = 0;
-    uint64_t             last_offset = 0;
-    std::vector<WTriple> term_triples;
+    PostingStream index_docs, index_freqs;
 
-    uint32_t docID, freqValue;
+    // index_docs.open("/datasets/okhattab/indexes/CatB/URL_index.docs");
+    // index_freqs.open("/datasets/okhattab/indexes/CatB/URL_index.freqs");
 
-    // FILE *index_docs  = fopen("/datasets/okhattab/indexes/CatB/URL_index.docs", "r");
-    // FILE *index_freqs = fopen("/datasets/okhattab/indexes/CatB/URL_index.freqs", "r");
+    index_docs.open("/datasets/okhattab/indexes/CatB/index.docs");
+    index_freqs.open("/datasets/okhattab/indexes/CatB/index.freqs");
 
-    FILE *index_docs  = fopen("/datasets/okhattab/indexes/CatB/index.docs", "r");
-    FILE *index_freqs = fopen("/datasets/okhattab/indexes/CatB/index.freqs", "r");
+    const uint32_t *docs, *freqs;
+    uint32_t        termDF, termDF2;
+
+    /* The docs file starts with a one-element sequence holding the number of docs. */
+    if (not index_docs.next(docs, termDF) or termDF != 1 or docs[0] != ndocs)
+    {
+        LOG.info("Unexpected header in index.docs (expected %u docs)\n", ndocs);
+        Env::exit(1);
+    }
 
-    fread(&docID, sizeof(uint32_t), 1, index_docs);
-    assert(docID == 1);
-    fread(&docID, sizeof(uint32_t), 1, index_docs);
-    LOG.info("%u, %u\n", docID, ndocs);
-    assert(docID == ndocs);
+    uint64_t offset      = 0;
+    uint64_t last_offset = 0;
 
     uint32_t above15 = 0, above17 = 0, above18 = 0;
     uint64_t num_blocks_with_64_postings = 0;
 
+    std::vector<PostingSpan> batch;
+    std::vector<bool>        batch_needed;
+    uint64_t                 batch_postings = 0;
+
     for (uint32_t termID = 0; termID < nterms; termID++)
     {
-        uint32_t termDF, termDF2;
-        size_t   df1_read = fread(&termDF, sizeof(uint32_t), 1, index_docs);
-        size_t   df2_read = fread(&termDF2, sizeof(uint32_t), 1, index_freqs);
-        assert(df1_read == 1);
-        assert(df2_read == 1);
-        assert(termDF == termDF2);
-
-        uint64_t termCF = 0;
+        if (not index_docs.next(docs, termDF) or not index_freqs.next(freqs, termDF2) or termDF != termDF2)
+        {
+            LOG.info("Mismatched or missing posting list for term %u\n", termID);
+            Env::exit(1);
+        }
 
         above15 += termDF >= (1 << 15);
         above17 += termDF >= (1 << 17);
@@ -111,59 +121,42 @@ void Graph<Weight>::read_edge_lists()
 
         num_blocks_with_64_postings += std::ceil(float(termDF) / 64.0);
 
-        // while (fread(&docID, sizeof(uint32_t), 1, index_docs) and fread(&freqValue, sizeof(uint32_t), 1,
-        // index_freqs))
-        for (uint32_t i = 0; i < termDF; i++)
-        {
-            size_t docid_read = fread(&docID, sizeof(uint32_t), 1, index_docs);
-            size_t freq_read  = fread(&freqValue, sizeof(uint32_t), 1, index_freqs);
-            assert(docid_read == 1);
-            assert(freq_read == 1);
-
-            termCF += freqValue;
-            buffer.push_back({termID, docID, freqValue});
-            assert(freqValue > 0);
-            assert(termCF < (1u << 31));
-            assert(docID < ndocs);
-        }
+#if FILTER_TERMS
+        bool need_this_term = needed_terms[termID];
+#else
+        bool need_this_term = true;
+#endif
 
-        if (offset - last_offset > 10 * 1000 * 1000)
-        {
-            LOG.info("| %8lu Terms (%f%%) -- buffer.capacity() = %.3f GiB \n", offset, termID / double(nterms) * 100.0,
-                     buffer.capacity() * sizeof(WTriple) / 1024.0 / 1024.0 / 1024.0);
-            last_offset = offset;
+        batch.push_back({docs, freqs, termID, termDF, 0});
+        batch_needed.push_back(need_this_term);
+        batch_postings += termDF;
 
-            LOG.info("###> [incomplete] num_blocks_with_64_postings = %u\n", num_blocks_with_64_postings);
-        }
+        offset += termDF;
 
-        auto cmp = [](const auto &t1, const auto &t2) {
-            return t1.term < t2.term or (t1.term == t2.term and t1.doc < t2.doc);
-        };
-        __gnu_parallel::sort(buffer.begin(), buffer.end(), cmp);
+        if (batch_postings < BatchPostings and termID + 1 < nterms) continue;
 
-        for (uint32_t i = 0; i < buffer.size(); i++)
-        {
-#if FILTER_TERMS
-            bool need_this_term = needed_terms[buffer[i].term];
-#else
-            bool need_this_term = true;
-#endif
+        A.add_terms(batch, batch_needed);
 
-            offset++;
-            A.add_triple(buffer[i]);
-            if (need_this_term) term_triples.push_back(buffer[i]);
+        batch.clear();
+        batch_needed.clear();
+        batch_postings = 0;
 
-            if ((i == buffer.size() - 1) or (buffer[i].term != buffer[i + 1].term))
-            {
-                assert(i == buffer.size() - 1);
-                if (need_this_term) A.add_term(term_triples.back().term, term_triples);
-                term_triples.clear();
-            }
-        }
+        index_docs.release_consumed(docs + termDF);
+        index_freqs.release_consumed(freqs + termDF);
+
+        if (offset - last_offset > 10 * 1000 * 1000)
+        {
+            LOG.info("| %8lu Postings (%f%% of terms) -- %.3f GiB read\n", offset, termID / double(nterms) * 100.0,
+                     (index_docs.nbytes_read() + index_freqs.nbytes_read()) / 1024.0 / 1024.0 / 1024.0);
+            last_offset = offset;
 
-        buffer.clear();
+            LOG.info("###> [incomplete] num_blocks_with_64_postings = %u\n", num_blocks_with_64_postings);
+        }
     }
 
+    index_docs.close();
+    index_freqs.close();
+
     LOG.info<false, false>("[%d]", Env::rank);
     Env::barrier();
     LOG.info<true, false>("\n");
@@ -0,0 +1,325 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "utils/env.h"
+#include "utils/log.h"
+#include "utils/mmap.h"
+
+/*
+ * Per-rank index container: <CachePrefix><rank>.index.bin
+ *
+ *   [IndexFileHeader][IndexSection x nsections][pad][section 0][pad][section 1]...
+ *
+ * Sections are 64-byte aligned (relative to the file, hence to the page-aligned mapping), record the
+ * size of their elements so that a layout change is detected instead of misread, and carry a checksum.
+ */
+enum IndexSectionID : uint32_t
+{
+    DOCS             = 1,
+    FREQS            = 2,
+    DOCS_OFFSETS     = 3,
+    FREQS_OFFSETS    = 4,
+    DOCS_NTERMS      = 5,
+    TERMS            = 6,
+    DOC_STATS        = 7,
+    COLLECTION_STATS = 8,
+    DIRECTORY        = 9, /* Optional: rebuilt from DOCS_OFFSETS and FREQS_OFFSETS when absent. */
+    CODEC            = 10, /* Optional: absent means PostingsCodec::legacy(). */
+
+    /* The bounds container (see bounds_cache.h); each *_ROWS holds the row ends of the FlatRows before it. */
+    BOUNDS_KEY         = 11,
+    MAXSCORES          = 12,
+    QMAXSCORES         = 13,
+    QMAXSCORES_ROWS    = 14,
+    /* 15 and 16 held the float block bounds, which are only kept quantized (in QMAXSCORES) since format 8. */
+    DOC_MAXSCORES      = 17,
+    DOC_MAXSCORES_ROWS = 18,
+    BMW_WDOC           = 19,
+    BMW_WDOC_ROWS      = 20,
+    BMW_SDOC           = 21,
+    BMW_SDOC_ROWS      = 22,
+    DOC_BOUNDS         = 23,
+    DOC_MESSAGES       = 24,
+    GLOBAL_DOC_BOUND   = 25,
+
+    /* Level l of the range pyramid is at these + 3 * l, for up to 8 levels. */
+    PYRAMID_MAXSCORES      = 26,
+    PYRAMID_MAXSCORES_ROWS = 27,
+    PYRAMID_DOC_BOUNDS     = 28,
+
+    /* Past the pyramid's. */
+    SPARSE_RANGES       = 50,
+    SPARSE_RANGES_ROWS  = 51,
+    SPARSE_CODES        = 52,
+    SPARSE_CODES_ROWS   = 53,
+    BLOCK_SHIFTS        = 54,
+    BMW_QMAXSCORES      = 55,
+    BMW_QMAXSCORES_ROWS = 56,
+};
+
+struct IndexFileHeader
+{
+    static constexpr uint64_t Magic   = 0x3130584D42797A4Cull; /* "LzyBMX01" */
+    static constexpr uint32_t Version = 1;
+
+    uint64_t magic     = Magic;
+    uint32_t version   = Version;
+    uint32_t nsections = 0;
+    uint64_t nbytes    = 0;
+    uint64_t reserved  = 0;
+};
+
+struct IndexSection
+{
+    uint32_t id;
+    uint32_t elem_size;
+    uint64_t offset;
+    uint64_t nbytes;
+    uint64_t checksum;
+};
+
+constexpr size_t IndexSectionAlignment = 64;
+
+/* Four independent multiply-rotate lanes; fast enough to run over the postings at disk speed. */
+inline uint64_t index_checksum(const uint8_t *data, size_t nbytes)
+{
+    constexpr uint64_t k1 = 0x9E3779B97F4A7C15ull;
+    constexpr uint64_t k2 = 0xC2B2AE3D27D4EB4Full;
+
+    auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+
+    uint64_t h[4] = {k1, k1 ^ k2, k2, k1 + k2};
+    size_t   i    = 0;
+
+    for (; i + 32 <= nbytes; i += 32)
+    {
+        for (int l = 0; l < 4; l++)
+        {
+            uint64_t w;
+            memcpy(&w, data + i + 8 * l, sizeof(w));
+            h[l] = rotl(h[l] ^ (w * k2), 31) * k1;
+        }
+    }
+
+    uint64_t r = nbytes;
+    for (int l = 0; l < 4; l++) r = rotl(r ^ h[l], 27) * k1 + k2;
+    for (; i < nbytes; i++) r = (r ^ data[i]) * 0x100000001B3ull;
+
+    return r ^ (r >> 29);
+}
+
+class IndexFileWriter
+{
+   public:
+    IndexFileWriter(const std::string &path) : path(path)
+    {
+    }
+
+    void add(IndexSectionID id, const void *data, size_t nbytes, size_t elem_size = 1)
+    {
+        sections.push_back({id, uint32_t(elem_size), 0, nbytes, 0});
+        payloads.push_back(static_cast<const uint8_t *>(data));
+    }
+
+    template <class T>
+    void add_array(IndexSectionID id, const T *data, size_t n)
+    {
+        add(id, data, n * sizeof(T), sizeof(T));
+    }
+
+    template <class T>
+    void add_value(IndexSectionID id, const T &value)
+    {
+        add(id, &value, sizeof(T), sizeof(T));
+    }
+
+    void write()
+    {
+        IndexFileHeader header;
+        header.nsections = sections.size();
+
+        uint64_t offset = sizeof(IndexFileHeader) + sections.size() * sizeof(IndexSection);
+        for (uint32_t i = 0; i < sections.size(); i++)
+        {
+            offset               = align(offset);
+            sections[i].offset   = offset;
+            sections[i].checksum = index_checksum(payloads[i], sections[i].nbytes);
+            offset += sections[i].nbytes;
+        }
+        header.nbytes = offset;
+
+        /* Written aside and renamed into place, so that a crash or a full disk never leaves a short file at path. */
+        std::string tmp_path = path + ".tmp";
+
+        FILE *f = fopen(tmp_path.c_str(), "w");
+        if (f == NULL)
+        {
+            LOG.info("Unable to create %s\n", tmp_path.c_str());
+            Env::exit(1);
+        }
+
+        bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+        ok      = ok and fwrite(sections.data(), sizeof(IndexSection), sections.size(), f) == sections.size();
+
+        const char zeros[IndexSectionAlignment] = {};
+        uint64_t   position                     = sizeof(IndexFileHeader) + sections.size() * sizeof(IndexSection);
+
+        for (uint32_t i = 0; i < sections.size(); i++)
+        {
+            size_t padding = sections[i].offset - position;
+            if (padding) ok = ok and fwrite(zeros, padding, 1, f) == 1;
+            if (sections[i].nbytes) ok = ok and fwrite(payloads[i], sections[i].nbytes, 1, f) == 1;
+            position = sections[i].offset + sections[i].nbytes;
+        }
+
+        ok = (fclose(f) == 0) and ok;
+        ok = ok and rename(tmp_path.c_str(), path.c_str()) == 0;
+
+        if (not ok)
+        {
+            LOG.info("Failed writing %s\n", path.c_str());
+            remove(tmp_path.c_str());
+            Env::exit(1);
+        }
+
+        LOG.info("Wrote %u sections (%.2f GiBs) to %s\n", sections.size(), header.nbytes / 1024.0 / 1024.0 / 1024.0,
+                 path.c_str());
+    }
+
+    static uint64_t align(uint64_t offset)
+    {
+        return (offset + IndexSectionAlignment - 1) / IndexSectionAlignment * IndexSectionAlignment;
+    }
+
+   private:
+    std::string                  path;
+    std::vector<IndexSection>    sections;
+    std::vector<const uint8_t *> payloads;
+};
+
+class IndexFile
+{
+   public:
+    void open(const std::string &path, bool populate = false)
+    {
+        if (const char *reason = try_open(path, populate)) fail(reason);
+    }
+
+    /* As open(), but for files that may be recomputed (see bounds_cache.h): what is wrong with it, or nullptr. */
+    const char *try_open(const std::string &path, bool populate = false)
+    {
+        this->path = path;
+        file.open(path, populate);
+
+        if (file.size() < sizeof(IndexFileHeader)) return "truncated header";
+
+        memcpy(&header, file.data(), sizeof(header));
+        if (header.magic != IndexFileHeader::Magic) return "bad magic";
+        if (header.version != IndexFileHeader::Version) return "unsupported version";
+        if (header.nbytes != file.size()) return "size mismatch";
+
+        sections.resize(header.nsections);
+        if (sizeof(header) + sections.size() * sizeof(IndexSection) > file.size()) return "truncated section table";
+        memcpy(sections.data(), file.data() + sizeof(header), sections.size() * sizeof(IndexSection));
+
+        for (auto &s : sections)
+        {
+            if (s.offset % IndexSectionAlignment or s.offset + s.nbytes > file.size()) return "bad section bounds";
+        }
+
+        return nullptr;
+    }
+
+    void close()
+    {
+        file.close();
+        sections.clear();
+    }
+
+    bool has(IndexSectionID id) const
+    {
+        return find(id) != nullptr;
+    }
+
+    const IndexSection &section(IndexSectionID id) const
+    {
+        const IndexSection *s = find(id);
+        if (not s) fail("missing section");
+        return *s;
+    }
+
+    /* NOTE: Points into the (read-only) mapping; valid until close(). */
+    uint8_t *data(IndexSectionID id) const
+    {
+        return file.data() + section(id).offset;
+    }
+
+    template <class T>
+    T *array(IndexSectionID id, size_t &n) const
+    {
+        const IndexSection &s = section(id);
+        if (s.elem_size != sizeof(T) or s.nbytes % sizeof(T)) fail("element size mismatch");
+
+        n = s.nbytes / sizeof(T);
+        return reinterpret_cast<T *>(file.data() + s.offset);
+    }
+
+    template <class T>
+    T value(IndexSectionID id) const
+    {
+        size_t n;
+        T *    v = array<T>(id, n);
+        if (n != 1) fail("expected a single value");
+        return *v;
+    }
+
+    /* Copies a section into a fresh, 64-byte aligned heap buffer (with the 7 bytes of EF read slack). */
+    uint8_t *copy(IndexSectionID id) const
+    {
+        const IndexSection &s   = section(id);
+        void *              buf = nullptr;
+        if (posix_memalign(&buf, IndexSectionAlignment, s.nbytes + 7)) Env::exit(1);
+        memcpy(buf, file.data() + s.offset, s.nbytes);
+        memset(static_cast<uint8_t *>(buf) + s.nbytes, 0, 7);
+        return static_cast<uint8_t *>(buf);
+    }
+
+    bool verify(IndexSectionID id) const
+    {
+        const IndexSection &s = section(id);
+        return index_checksum(file.data() + s.offset, s.nbytes) == s.checksum;
+    }
+
+    void advise(IndexSectionID id, int advice) const
+    {
+        const IndexSection &s    = section(id);
+        size_t              page = sysconf(_SC_PAGESIZE);
+        uint64_t            beg  = s.offset / page * page;
+        if (s.nbytes) madvise(file.data() + beg, s.offset + s.nbytes - beg, advice);
+    }
+
+    [[noreturn]] void fail(const char *reason) const
+    {
+        LOG.info("Corrupt or incompatible index file %s: %s\n", path.c_str(), reason);
+        Env::exit(1);
+    }
+
+   private:
+    const IndexSection *find(IndexSectionID id) const
+    {
+        for (auto &s : sections)
+            if (s.id == id) return &s;
+        return nullptr;
+    }
+
+    std::string               path;
+    MappedFile                file;
+    IndexFileHeader           header;
+    std::vector<IndexSection> sections;
+};
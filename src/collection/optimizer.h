@@ -1,21 +1,63 @@
 #pragma once
 
+#include <omp.h>
 #include <set>
 #include "api/bm25.h"
+#include "collection/block_tuner.h"
+#include "collection/bounds_cache.h"
 #include "collection/collection.h"
+#include "collection/quantized_bounds.h"
 
-float get_block_bound(RectangularMatrix<EdgeWeight>& A, uint32_t idx, float z, uint32_t local_df, uint32_t range)
+/* Doc ranges per block bound (log2) of term idx, for the doc-range layout. */
+inline uint32_t block_bound_shift(const RectangularMatrix<EdgeWeight>& A, uint32_t idx)
 {
-    if (local_df < (1 << 15)) return A.bmw_maxscores[idx][range];
-    if (local_df < (1 << 17)) range >>= 1;
-    if (local_df < (1 << 18)) range >>= 1;
+    return A.block_shifts[idx];
+}
+
+float get_block_bound(const RectangularMatrix<EdgeWeight>& A, uint32_t idx, float z, uint32_t local_df, uint32_t range)
+{
+    if (local_df < SparseRangeBounds::MaxDF) return A.sparse_bounds.bound(idx, z, range);
 
-    return A.qmaxscores[idx][range] ? (z * A.qmaxscores[idx][range] + 0.0001) : 0.0f;
+    range >>= block_bound_shift(A, idx);
+    return QuantizedBounds::decode(QuantizedBounds::get(A.qmaxscores[idx], range), z);
 
     // return maxscores[range];
     // if (local_df < (52075585 / 100)) range >>= 2;
 }
 
+static_assert(PYRAMID_LEVELS >= 1, "The pyramid has at least one level");
+
+/* Fills term idx's pyramid: the max of its get_block_bound() over each group of ranges, level by level. Short lists
+ * have none: their SparseRangeBounds::Cursor bounds the groups from their few nonzero ranges. */
+void build_range_pyramid(RectangularMatrix<EdgeWeight>& A, uint32_t idx, float z)
+{
+    using Message = RectangularMatrix<EdgeWeight>::Message;
+
+    uint32_t local_df = A.terms[idx].local_df;
+    uint32_t nranges  = 1 + (A.rank_ndocs >> SHARD_RADIX);
+
+    if (local_df < SparseRangeBounds::MaxDF) return;
+
+    for (auto& rows : A.pyramid_maxscores) std::fill(rows[idx], rows[idx] + rows.row_size(idx), Message());
+
+    Message* level = A.pyramid_maxscores[0][idx];
+
+    for (uint32_t range = 0; range < nranges; range++)
+    {
+        Message& b = level[range >> PYRAMID_RADIX];
+        b          = std::max(b, Message(get_block_bound(A, idx, z, local_df, range)));
+    }
+
+    for (uint32_t l = 1; l < PYRAMID_LEVELS; l++)
+    {
+        Message* below = A.pyramid_maxscores[l - 1][idx];
+        level          = A.pyramid_maxscores[l][idx];
+
+        for (uint32_t r = 0; r <= ((nranges - 1) >> (PYRAMID_RADIX * l)); r++)
+            level[r >> PYRAMID_RADIX] = std::max(level[r >> PYRAMID_RADIX], below[r]);
+    }
+}
+
 void optimize_model(Collection& C, RectangularMatrix<EdgeWeight>& A, const std::string& queries_path, uint32_t nqueries)
 {
     using UserTermStats = ChosenTerm2Doc::TermStats;
@@ -27,105 +69,128 @@ void optimize_model(Collection& C, RectangularMatrix<EdgeWeight>& A, const std::
     /* Finalize the local doc stats. */
     for (auto& d1 : A.static_doc_stats) A.doc_stats.emplace_back(A.collection_stats, d1);
 
-    for (uint32_t i = 0; i < A.terms.size(); i++)
+#if CACHE_BOUNDS
+    BoundsCache bounds_cache(A, TUNE_BLOCK_SHIFTS ? query_log_fingerprint(queries_path, nqueries) : 0);
+
+    if (bounds_cache.load())
     {
-        A.qmaxscores.emplace_back();
-        A.bmw_maxscores.emplace_back();
-        A.doc_maxscores.emplace_back();
-        A.maxscores.emplace_back();
-        A.cache.emplace_back();
-
-        A.bmw_wdoc.emplace_back();
-        A.bmw_wdoc.back().resize(2 + (A.terms[i].local_df / SHARD_NDOCS));
-        std::fill(A.bmw_wdoc.back().begin(), A.bmw_wdoc.back().end(), A.rank_ndocs);
-
-        A.bmw_sdoc.emplace_back();
-        A.bmw_sdoc.back().resize(2 + (A.terms[i].local_df / SHARD_NDOCS));
-        std::fill(A.bmw_sdoc.back().begin(), A.bmw_sdoc.back().end(), A.rank_ndocs);
-
-        uint32_t s = std::max(A.rank_ndocs >> SHARD_RADIX, A.terms[i].local_df / SHARD_NDOCS);
-        A.qmaxscores.back().resize(2 + s);
-        A.bmw_maxscores.back().resize(2 + s);
-        A.doc_maxscores.back().resize(2 + s);
+        A.cache.resize(A.terms.size());
+        return;
     }
+#endif
 
-    std::vector<DocCompression::Reader> readers;
-    std::vector<FreqIterator>           fiterators;
+    A.maxscores.resize(A.terms.size());
+    A.cache.resize(A.terms.size());
 
-    for (uint32_t i = 0; i < A.terms.size(); i++)
+#if TUNE_BLOCK_SHIFTS
+    BlockTuner(C, A).tune(queries_path, nqueries);
+#else
+    A.block_shifts.resize(A.terms.size());
+    for (uint32_t i = 0; i < A.terms.size(); i++) A.block_shifts[i] = default_block_shift(A.terms[i].local_df);
+#endif
+
+    /* Both layouts are computed, so that every query program runs on the one index (see QueryPrograms):
+     * per block of SHARD_NDOCS postings for the block-max programs, and per doc range for the doc-range ones. */
+    auto nblocks = [&](size_t i) { return 2 + (A.terms[i].local_df / SHARD_NDOCS); };
+    auto nranges = [&](size_t i) { return 2 + std::max(A.rank_ndocs >> SHARD_RADIX, A.terms[i].local_df / SHARD_NDOCS); };
+
+    A.bmw_wdoc.reset(A.terms.size(), nblocks, A.rank_ndocs);
+    A.bmw_sdoc.reset(A.terms.size(), nblocks, A.rank_ndocs);
+    A.bmw_qmaxscores.reset(A.terms.size(), [&](size_t i) { return QuantizedBounds::nwords(nblocks(i)); });
+    A.doc_maxscores.reset(A.terms.size(), nblocks);
+
+    /* Short lists are bounded sparsely (see sparse_bounds.h), the others per 1 << block_bound_shift() ranges. */
+    auto dense_ranges = [&](size_t i) -> size_t {
+        uint32_t local_df = A.terms[i].local_df;
+        if (local_df < SparseRangeBounds::MaxDF) return 0;
+
+        return 2 + ((A.rank_ndocs >> SHARD_RADIX) >> block_bound_shift(A, i));
+    };
+
+    SparseRangeBounds::Staging sparse_staging(A.terms.size(), 8); /* One buffer per thread of the loop below. */
+
+    A.qmaxscores.reset(A.terms.size(), [&](size_t i) { return QuantizedBounds::nwords(dense_ranges(i)); });
+
+    for (uint32_t l = 0; l < PYRAMID_LEVELS; l++)
     {
-        auto& term = A.terms[i];
-        readers.emplace_back(doc_ids_reader.get_docs(i, A.terms[i].local_df));
-        fiterators.emplace_back(doc_ids_reader.get_freqs(i, A.terms[i].local_df, A.terms[i].local_cf));
+        uint32_t radix = PYRAMID_RADIX * (l + 1);
+        A.pyramid_maxscores[l].reset(A.terms.size(), [&](size_t i) -> size_t {
+            return A.terms[i].local_df < SparseRangeBounds::MaxDF ? 0 : (nranges(i) >> radix) + 1;
+        });
     }
 
-#pragma omp parallel for schedule(dynamic, 8) num_threads(8)
-    for (uint32_t i = 1; i < A.terms.size(); i++)
+#pragma omp parallel num_threads(8)
     {
-        if (i % (A.terms.size() / 100) == 0)
-            LOG.info("Processing term %u (df = %u, cf = %u)\n", i, A.terms[i].local_df, A.terms[i].local_cf);
+        /* Per thread: the term's float bounds per block and per range, until encoded into its rows. */
+        std::vector<Message> block_bounds;
+        std::vector<Message> range_bounds;
 
-        auto& term      = A.terms[i];
-        auto& reader    = readers[i];
-        auto& fiterator = fiterators[i];
+#pragma omp for schedule(dynamic, 8)
+        for (uint32_t i = 1; i < A.terms.size(); i++)
+        {
+            if (i % (A.terms.size() / 100) == 0)
+                LOG.info("Processing term %u (df = %u, cf = %u)\n", i, A.terms[i].local_df, A.terms[i].local_cf);
 
-        auto term_stats = UserTermStats(A.collection_stats, A.user_term_stats[i]);
-        auto term_bound = Message();
+            /* Cursors are opened here rather than for all terms up front: the block codec's hold a decoded block. */
+            auto& term      = A.terms[i];
+            auto  reader    = doc_ids_reader.get_docs(i, A.terms[i].local_df);
+            auto  fiterator = doc_ids_reader.get_freqs(i, A.terms[i].local_df, A.terms[i].local_cf);
 
-        for (reader.next(); reader.value() < A.rank_ndocs; reader.next())
-        {
-            uint32_t doc = reader.value();
+            auto term_stats = UserTermStats(A.collection_stats, A.user_term_stats[i]);
+            auto term_bound = Message();
+            bool sparse     = term.local_df < SparseRangeBounds::MaxDF;
+
+            block_bounds.assign(nblocks(i), Message());
+            range_bounds.assign(dense_ranges(i), Message());
+            if (sparse) sparse_staging.start(i, omp_get_thread_num());
 
-            auto freq = fiterator.advance_and_read();
-            if (freq > 9999999)
+            for (reader.next(); reader.value() < A.rank_ndocs; reader.next())
             {
-                LOG.info("i = %u (position = %u)\n", i, fiterator.reader.position());
-                // break;
-            }
+                uint32_t doc = reader.value();
 
-            auto impact = model.send(term_stats, freq, A.doc_stats[doc]);
-            term_bound  = std::max(term_bound, impact);
+                auto freq = fiterator.advance_and_read();
+                if (freq > 9999999)
+                {
+                    LOG.info("i = %u (position = %u)\n", i, fiterator.reader.position());
+                    // break;
+                }
 
-#if BMW or BMM or IBMM or LBMM or VBMW or LBMW
-            uint32_t current_shard            = reader.position() / SHARD_NDOCS;
-            A.bmw_maxscores[i][current_shard] = std::max(A.bmw_maxscores[i][current_shard], impact);
-            A.bmw_wdoc[i][current_shard]      = doc;
-            A.bmw_sdoc[i][current_shard]      = std::min(A.bmw_sdoc[i][current_shard], doc);
+                auto impact = model.send(term_stats, freq, A.doc_stats[doc]);
+                term_bound  = std::max(term_bound, impact);
 
-            auto doc_impact = model.self_send(A.doc_stats[doc], C.doc_idx2label(doc), C.doc_idx2pr(doc));
-            A.doc_maxscores[i][current_shard] = std::max(A.doc_maxscores[i][current_shard], doc_impact);
-#else
-            uint32_t current_shard = doc >> SHARD_RADIX;
-            if (term.local_df < (1 << 18)) current_shard >>= 1;
-            if (term.local_df < (1 << 17)) current_shard >>= 1;
+                uint32_t block       = reader.position() / SHARD_NDOCS;
+                block_bounds[block]  = std::max(block_bounds[block], impact);
+                A.bmw_wdoc[i][block] = doc;
+                A.bmw_sdoc[i][block] = std::min(A.bmw_sdoc[i][block], doc);
 
-            // if (term.local_df < (52075585 / 100)) current_shard >>= 2;
-            A.bmw_maxscores[i][current_shard] = std::max(A.bmw_maxscores[i][current_shard], impact);
-#endif
+                auto doc_impact = model.self_send(A.doc_stats[doc], C.doc_idx2label(doc), C.doc_idx2pr(doc));
+                A.doc_maxscores[i][block] = std::max(A.doc_maxscores[i][block], doc_impact);
 
-            if (A.bmw_maxscores[i][current_shard] < -0.0001)
-                LOG.info("A.bmw_maxscores[i][current_shard] = %f\n\n\n", A.bmw_maxscores[i][current_shard]);
-        }
+                if (impact < -0.0001) LOG.info("impact = %f\n\n\n", impact);
 
-        A.maxscores[i] = term_bound;
+                if (sparse)
+                {
+                    sparse_staging.add(i, doc >> SHARD_RADIX, impact);
+                    continue;
+                }
 
-        Message z = term_bound / 255.0f;
+                uint32_t range      = (doc >> SHARD_RADIX) >> block_bound_shift(A, i);
+                range_bounds[range] = std::max(range_bounds[range], impact);
+            }
 
-        for (uint32_t j = 0; j < A.bmw_maxscores[i].size(); j++)
-        {
-            if (A.bmw_maxscores[i][j] > 0.000000001)
-                A.qmaxscores[i][j] = std::min(255, std::max(0, int(std::ceil(A.bmw_maxscores[i][j] / z))));
-            // std::max(std::min(int(std::ceil((A.bmw_maxscores[i][j]) / z)), 255), 0);
+            A.maxscores[i] = term_bound;
 
-            if (z * A.qmaxscores[i][j] + 0.0001 < A.bmw_maxscores[i][j])
-            {
-                LOG.info("%u, %u, %f, %f, %f\n", A.qmaxscores[i][j], uint32_t(1 + A.bmw_maxscores[i][j] / z),
-                         z * A.qmaxscores[i][j], A.bmw_maxscores[i][j], term_bound);
-                Env::exit(0);
-            }
+            Message z = QuantizedBounds::scale(term_bound);
+            QuantizedBounds::encode_row(block_bounds.data(), block_bounds.size(), z, A.bmw_qmaxscores[i]);
+            QuantizedBounds::encode_row(range_bounds.data(), range_bounds.size(), z, A.qmaxscores[i]);
         }
     }
 
+    A.sparse_bounds.assign(sparse_staging, A.maxscores);
+
+#pragma omp parallel for schedule(dynamic, 8) num_threads(8)
+    for (uint32_t i = 1; i < A.terms.size(); i++) build_range_pyramid(A, i, QuantizedBounds::scale(A.maxscores[i]));
+
 #if BMW or BMM or IBMM or LBMM or VBMW or LBMW
     /* Histogram for score distributions. */
     std::vector<uint32_t> score_fraction_counter(101);
@@ -133,9 +198,12 @@ void optimize_model(Collection& C, RectangularMatrix<EdgeWeight>& A, const std::
     for (uint32_t i = 0; i < A.terms.size(); i++)
     {
         uint32_t this_size = int(std::ceil(A.terms[i].local_df / float(SHARD_NDOCS)));
+        Message  z         = QuantizedBounds::scale(A.maxscores[i]);
         for (uint32_t j = 0; j < this_size; j++)
         {
-            float fraction = std::lround(100.0 * A.bmw_maxscores[i][j] / A.maxscores[i]);
+            /* Rounded up when quantized, so possibly over the term bound. */
+            auto bound    = QuantizedBounds::decode(QuantizedBounds::get(A.bmw_qmaxscores[i], j), z);
+            auto fraction = std::min(100l, std::lround(100.0 * bound / A.maxscores[i]));
             score_fraction_counter[fraction] += 1;
         }
     }
@@ -166,7 +234,7 @@ void optimize_model(Collection& C, RectangularMatrix<EdgeWeight>& A, const std::
 
     for (uint32_t doc = 0; doc < A.rank_ndocs; doc++)
     {
-        if ((doc & (SHARD_NDOCS - 1)) == 0) A.doc_bounds.emplace_back();
+        if ((doc & (SHARD_NDOCS - 1)) == 0) A.doc_bounds.push_back({});
 
         auto impact         = model.self_send(A.doc_stats[doc], C.doc_idx2label(doc), C.doc_idx2pr(doc));
         A.doc_bounds.back() = model.ubound(A.doc_bounds.back(), impact);
@@ -174,5 +242,11 @@ void optimize_model(Collection& C, RectangularMatrix<EdgeWeight>& A, const std::
         A.doc_messages.push_back(impact);
     }
 
-    A.doc_bounds.emplace_back();
+    A.doc_bounds.push_back({});
+
+    A.build_doc_bound_pyramid(model);
+
+#if CACHE_BOUNDS
+    bounds_cache.save();
+#endif
 }
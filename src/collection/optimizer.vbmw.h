@@ -5,12 +5,28 @@
 // SPL in {8: 3.0, 16: 7.0, 32: 15.0, 29.0, 52.0, 77.0}
 // LMDir in {3.0, 7.0, 15.0, 32.0, 56.0, 85.0}
 
+#include <omp.h>
 #include <set>
-#include <atomic>
+#include <numeric>
 #include "api/bm25.h"
+#include "collection/bounds_cache.h"
 #include "collection/collection.h"
+#include "collection/quantized_bounds.h"
 #include "collection/vbmw.hpp"
 
+BlockBoundCursor block_bound_cursor(const RectangularMatrix<EdgeWeight>& A, uint32_t idx)
+{
+    auto z = QuantizedBounds::scale(A.maxscores[idx]);
+    return BlockBoundCursor(A.bmw_wdoc[idx], A.bmw_qmaxscores[idx], A.bmw_wdoc.row_size(idx), z);
+}
+
+/* The max bound of term idx's blocks over the docs of a doc range, for the doc-range programs. */
+float get_block_bound(const RectangularMatrix<EdgeWeight>& A, uint32_t idx, float z, uint32_t local_df, uint32_t range)
+{
+    uint32_t offset = range << SHARD_RADIX;
+    return block_bound_cursor(A, idx).max_bound(offset, std::min(A.rank_ndocs, offset + SHARD_NDOCS));
+}
+
 void optimize_model(Collection& C, RectangularMatrix<EdgeWeight>& A, const std::string& queries_path, uint32_t nqueries)
 {
     using UserTermStats = ChosenTerm2Doc::TermStats;
@@ -20,85 +36,127 @@ void optimize_model(Collection& C, RectangularMatrix<EdgeWeight>& A, const std::
     /* Finalize the local doc stats. */
     for (auto& d1 : A.static_doc_stats) A.doc_stats.emplace_back(A.collection_stats, d1);
 
+#if CACHE_BOUNDS
+    BoundsCache bounds_cache(A);
+
+    if (bounds_cache.load()) return;
+#endif
+
     auto model = ChosenTerm2Doc(A.collection_stats);
 
     LOG.info("\n\nProcessing VBMW_COST = %.1f\n", VBMW_COST);
 
-    for (uint32_t i = 0; i < A.terms.size(); i++)
+    A.maxscores.resize(A.terms.size());
+
+    auto nranges = [&](size_t i) { return 2 + std::max(A.rank_ndocs >> SHARD_RADIX, A.terms[i].local_df / SHARD_NDOCS); };
+    A.doc_maxscores.reset(A.terms.size(), nranges);
+
+    /* The partitions are only known once optimized: each thread appends its terms' to buffers of its own, which
+     * are copied into the rows (sized by then) after the loop. Each term's blocks end with a rank_ndocs sentinel. */
+    struct Partitions
     {
-        A.bmw_wdoc.emplace_back();
-        A.bmw_maxscores.emplace_back();
-        A.bmw_wdoc.back().resize(2 + (A.terms[i].local_df / SHARD_NDOCS));
-        A.bmw_maxscores.back().resize(2 + (A.terms[i].local_df / SHARD_NDOCS));
-        std::fill(A.bmw_wdoc.back().begin(), A.bmw_wdoc.back().end(), A.rank_ndocs);
-        A.maxscores.emplace_back();
-
-        uint32_t s = std::max(A.rank_ndocs >> SHARD_RADIX, A.terms[i].local_df / SHARD_NDOCS);
-        A.doc_maxscores.emplace_back();
-        A.doc_maxscores.back().resize(2 + s);
-    }
+        std::vector<uint32_t> wdoc;
+        std::vector<Message>  bounds;
+    };
 
-    std::atomic<size_t> total_postings(0);
-    std::atomic<size_t> total_blocks(0);
+    std::vector<Partitions> partitions(8); /* One per thread of the loop below. */
+    std::vector<uint32_t>   term_thread(A.terms.size());
+    std::vector<size_t>     term_begin(A.terms.size());
+    std::vector<size_t>     term_nblocks(A.terms.size());
 
-    std::vector<DocCompression::Reader> readers;
-    std::vector<FreqIterator>           fiterators;
+    /* Longest lists first, so that no giant list starts last and straggles. */
+    std::vector<uint32_t> order(A.terms.size() - 1);
+    std::iota(order.begin(), order.end(), 1);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return A.terms[a].local_df > A.terms[b].local_df; });
 
-    for (uint32_t i = 0; i < A.terms.size(); i++)
-    {
-        auto& term = A.terms[i];
-        readers.emplace_back(doc_ids_reader.get_docs(i, A.terms[i].local_df));
-        fiterators.emplace_back(doc_ids_reader.get_freqs(i, A.terms[i].local_df, A.terms[i].local_cf));
-    }
+    size_t total_postings = 0;
+    size_t total_blocks   = 0;
 
-#pragma omp parallel for schedule(dynamic, 8) num_threads(8)
-    for (uint32_t i = 1; i < A.terms.size(); i++)
+#pragma omp parallel num_threads(8) reduction(+ : total_postings, total_blocks)
     {
-        if (i % (A.terms.size() / 100) == 0)
-            LOG.info("Processing term %u (df = %u, cf = %u)\n", i, A.terms[i].local_df, A.terms[i].local_cf);
+        /* Per thread, reused across its terms. */
+        ds2i::score_opt_partitioner partitioner;
+        std::vector<uint32_t>       docs;
+        std::vector<float>          scores;
+
+#pragma omp for schedule(dynamic, 1)
+        for (size_t k = 0; k < order.size(); k++)
+        {
+            uint32_t i = order[k];
 
-        auto& term      = A.terms[i];
-        auto& reader    = readers[i];
-        auto& fiterator = fiterators[i];
+            if (k % (order.size() / 100 + 1) == 0)
+                LOG.info("Processing term %u (df = %u, cf = %u)\n", i, A.terms[i].local_df, A.terms[i].local_cf);
 
-        auto term_stats = UserTermStats(A.collection_stats, A.user_term_stats[i]);
-        auto term_bound = Message();
+            /* Cursors are opened here rather than for all terms up front: the block codec's hold a decoded block. */
+            auto& term      = A.terms[i];
+            auto  reader    = doc_ids_reader.get_docs(i, A.terms[i].local_df);
+            auto  fiterator = doc_ids_reader.get_freqs(i, A.terms[i].local_df, A.terms[i].local_cf);
 
-        std::vector<std::tuple<uint64_t, float>> scores;
+            auto term_stats = UserTermStats(A.collection_stats, A.user_term_stats[i]);
+            auto term_bound = Message();
 
-        for (reader.next(); reader.value() < A.rank_ndocs; reader.next())
-        {
-            uint32_t doc            = reader.value();
-            uint32_t freq           = fiterator.advance_and_read();
-            auto     current_impact = model.send(term_stats, freq, A.doc_stats[doc]);
-            scores.emplace_back(doc, current_impact);
-            term_bound = model.ubound(term_bound, current_impact);
-
-            uint32_t current_shard = reader.position() / SHARD_NDOCS;
-            auto     doc_impact    = model.self_send(A.doc_stats[doc], C.doc_idx2label(doc), C.doc_idx2pr(doc));
-            A.doc_maxscores[i][current_shard] = std::max(A.doc_maxscores[i][current_shard], doc_impact);
+            docs.clear();
+            scores.clear();
+
+            for (reader.next(); reader.value() < A.rank_ndocs; reader.next())
+            {
+                uint32_t doc            = reader.value();
+                uint32_t freq           = fiterator.advance_and_read();
+                auto     current_impact = model.send(term_stats, freq, A.doc_stats[doc]);
+                docs.push_back(doc);
+                scores.push_back(current_impact);
+                term_bound = model.ubound(term_bound, current_impact);
+
+                uint32_t current_shard = reader.position() / SHARD_NDOCS;
+                auto     doc_impact    = model.self_send(A.doc_stats[doc], C.doc_idx2label(doc), C.doc_idx2pr(doc));
+                A.doc_maxscores[i][current_shard] = std::max(A.doc_maxscores[i][current_shard], doc_impact);
+            }
+
+            partitioner.run(docs.data(), scores.data(), docs.size(), VBMW_COST);
+
+            total_postings += term.local_df;
+            total_blocks += partitioner.docids.size();
+
+            uint32_t thread = omp_get_thread_num();
+            auto&    mine   = partitions[thread];
+
+            term_thread[i]  = thread;
+            term_begin[i]   = mine.wdoc.size();
+            term_nblocks[i] = partitioner.docids.size() + 1;
+
+            mine.wdoc.insert(mine.wdoc.end(), partitioner.docids.begin(), partitioner.docids.end());
+            mine.wdoc.push_back(A.rank_ndocs);
+            mine.bounds.insert(mine.bounds.end(), partitioner.max_values.begin(), partitioner.max_values.end());
+            mine.bounds.emplace_back();
+
+            A.maxscores[i] = term_bound;
         }
+    }
 
-        auto p = ds2i::score_opt_partition(scores.begin(), scores.size(), VBMW_COST);
+    LOG.info("total_postings / total_blocks = %f\n", double(total_postings) / double(total_blocks));
 
-        total_postings += term.local_df;
-        total_blocks += p.docids.size();
+    /* Terms left out of the loop (i.e., 0) have the sentinel block alone. Only the quantized bounds are kept. */
+    auto nblocks = [&](size_t i) { return std::max(size_t(1), term_nblocks[i]); };
 
-        LOG.info("[%u] total_postings / total_blocks = %f\n", i, double(total_postings) / double(total_blocks));
+    A.bmw_wdoc.reset(A.terms.size(), nblocks, A.rank_ndocs);
+    A.bmw_qmaxscores.reset(A.terms.size(), [&](size_t i) { return QuantizedBounds::nwords(nblocks(i)); });
 
-        A.bmw_maxscores[i] = p.max_values;
-        A.bmw_wdoc[i]      = p.docids;
-        A.maxscores[i]     = term_bound;
+    for (uint32_t i = 1; i < A.terms.size(); i++)
+    {
+        auto& theirs = partitions[term_thread[i]];
+        auto  z      = QuantizedBounds::scale(A.maxscores[i]);
 
-        A.bmw_wdoc[i].push_back(A.rank_ndocs);
-        A.bmw_maxscores[i].emplace_back();
+        std::copy_n(theirs.wdoc.data() + term_begin[i], term_nblocks[i], A.bmw_wdoc[i]);
+        QuantizedBounds::encode_row(theirs.bounds.data() + term_begin[i], term_nblocks[i], z, A.bmw_qmaxscores[i]);
     }
 
+    partitions.clear();
+
     A.doc_bounds.clear();
 
     for (uint32_t doc = 0; doc < A.rank_ndocs; doc++)
     {
-        if ((doc & (SHARD_NDOCS - 1)) == 0) A.doc_bounds.emplace_back();
+        if ((doc & (SHARD_NDOCS - 1)) == 0) A.doc_bounds.push_back({});
 
         auto current_impact = model.self_send(A.doc_stats[doc], C.doc_idx2label(doc), C.doc_idx2pr(doc));
         A.doc_bounds.back() = model.ubound(A.doc_bounds.back(), current_impact);
@@ -106,5 +164,10 @@ void optimize_model(Collection& C, RectangularMatrix<EdgeWeight>& A, const std::
         A.doc_messages.push_back(current_impact);
     }
 
-    A.doc_bounds.emplace_back();
+    A.doc_bounds.push_back({});
+    A.build_doc_bound_pyramid(model);
+
+#if CACHE_BOUNDS
+    bounds_cache.save();
+#endif
 }
@@ -0,0 +1,387 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <vector>
+#include "folly/EliasFano.h"
+#include "utils/common.h"
+
+/*
+ * Partitioned Elias-Fano (Ottaviano and Venturini, SIGIR'14), for strictly increasing lists.
+ *
+ * The list is cut into chunks, each encoded relative to the end of the previous chunk with whichever is smallest:
+ * Elias-Fano, a bitmap over the chunk's universe, or nothing at all for a run of consecutive values. Clustered
+ * lists (e.g., URL-ordered doc IDs) get dense chunks that are both smaller and faster to walk.
+ *
+ *   [nchunks][last x nchunks][end x nchunks][offset|type x nchunks][pad][payload 0][pad][payload 1]...
+ *
+ * last is the largest value of a chunk and end the position one past it; offsets are relative to payload 0 and
+ * 8-byte aligned, which leaves their low bits for the chunk type. Boundaries are chosen by an exact shortest path
+ * over every kBlock-th position, with chunks of at most kMaxBlocks blocks, so partitioning stays linear in the
+ * list length.
+ *
+ * Exposes the encode()/reader() interface of Compression<>. Unlike Elias-Fano, the encoded size depends on the
+ * values and not only on their bound and count.
+ */
+template <typename Value, size_t kSkipQuantum = 0>
+struct PartitionedCompression
+{
+    static constexpr size_t kBlock     = 64;
+    static constexpr size_t kMaxBlocks = 64;
+
+    enum ChunkType : uint32_t
+    {
+        EF     = 0,
+        BITMAP = 1,
+        RUN    = 2,
+    };
+
+    using ChunkEncoder = folly::compression::EliasFanoEncoderV2<Value, Value, kSkipQuantum, 0>;
+    using ChunkLayout  = typename ChunkEncoder::Layout;
+    using ChunkReader =
+        folly::compression::EliasFanoReader<ChunkEncoder, folly::compression::instructions::Default, true>;
+
+    struct Chunk
+    {
+        size_t    end;
+        ChunkType type;
+        size_t    nbytes;
+    };
+
+    class Reader;
+
+    static size_t encode(const std::vector<Value>& v, uint8_t* buf)
+    {
+        std::vector<Chunk> chunks;
+        partition(v, chunks);
+
+        size_t    nchunks = chunks.size();
+        uint32_t* header  = reinterpret_cast<uint32_t*>(buf);
+        size_t    nbytes  = header_nbytes(nchunks);
+        size_t    offset  = 0;
+
+        memset(buf, 0, nbytes);
+        header[0] = nchunks;
+
+        std::vector<Value> tmp;
+
+        for (size_t c = 0; c < nchunks; c++)
+        {
+            size_t   begin = c ? chunks[c - 1].end : 0;
+            Value    base  = c ? v[begin - 1] + 1 : 0;
+            Value    last  = v[chunks[c].end - 1];
+            uint8_t* data  = buf + nbytes + offset;
+
+            header[1 + c]               = last;
+            header[1 + nchunks + c]     = chunks[c].end;
+            header[1 + 2 * nchunks + c] = offset | chunks[c].type;
+
+            memset(data, 0, chunks[c].nbytes);
+
+            if (chunks[c].type == EF)
+            {
+                tmp.clear();
+                for (size_t i = begin; i < chunks[c].end; i++) tmp.push_back(v[i] - base);
+                ChunkEncoder::encode_into_buffer(tmp.begin(), tmp.end(), last - base, data);
+            }
+            else if (chunks[c].type == BITMAP)
+            {
+                for (size_t i = begin; i < chunks[c].end; i++) data[(v[i] - base) / 8] |= 1u << ((v[i] - base) % 8);
+            }
+
+            offset += chunks[c].nbytes;
+        }
+
+        return nbytes + offset;
+    }
+
+    /* What encode() returns (and writes, padding included). */
+    static size_t encoded_nbytes(const std::vector<Value>& v)
+    {
+        std::vector<Chunk> chunks;
+        partition(v, chunks);
+
+        size_t nbytes = header_nbytes(chunks.size());
+        for (auto& c : chunks) nbytes += c.nbytes;
+
+        return nbytes;
+    }
+
+    static Reader reader(size_t bound, size_t size, const uint8_t* buf)
+    {
+        return Reader(bound, size, buf);
+    }
+
+   private:
+    static size_t align(size_t nbytes)
+    {
+        return (nbytes + 7) / 8 * 8;
+    }
+
+    static size_t header_nbytes(size_t nchunks)
+    {
+        return align(sizeof(uint32_t) * (1 + 3 * nchunks));
+    }
+
+    /* Payload size of the chunk holding m values in [base, last], with last among them. */
+    static size_t chunk_nbytes(Value base, Value last, size_t m, ChunkType& type)
+    {
+        uint64_t universe = uint64_t(last) - base + 1;
+
+        if (universe == m)
+        {
+            type = RUN;
+            return 0;
+        }
+
+        size_t bitmap = (universe + 63) / 64 * 8;
+        size_t ef     = align(ChunkLayout::fromUpperBoundAndSize(last - base, m).bytes());
+
+        type = bitmap < ef ? BITMAP : EF;
+        return std::min(bitmap, ef);
+    }
+
+    /* Shortest path over the block boundaries, where an edge costs its chunk's payload plus its header entry. */
+    static void partition(const std::vector<Value>& v, std::vector<Chunk>& chunks)
+    {
+        size_t n       = v.size();
+        size_t nblocks = (n + kBlock - 1) / kBlock;
+
+        auto boundary = [&](size_t b) { return std::min(n, b * kBlock); };
+        auto base     = [&](size_t b) { return b ? v[boundary(b) - 1] + 1 : Value(0); };
+
+        std::vector<size_t> cost(nblocks + 1, std::numeric_limits<size_t>::max());
+        std::vector<size_t> from(nblocks + 1, 0);
+        cost[0] = 0;
+
+        for (size_t j = 1; j <= nblocks; j++)
+        {
+            for (size_t i = j > kMaxBlocks ? j - kMaxBlocks : 0; i < j; i++)
+            {
+                ChunkType type;
+                size_t    c = cost[i] + 3 * sizeof(uint32_t) +
+                           chunk_nbytes(base(i), v[boundary(j) - 1], boundary(j) - boundary(i), type);
+
+                if (c < cost[j])
+                {
+                    cost[j] = c;
+                    from[j] = i;
+                }
+            }
+        }
+
+        chunks.clear();
+        for (size_t j = nblocks; j > 0; j = from[j])
+        {
+            ChunkType type;
+            size_t    nbytes = chunk_nbytes(base(from[j]), v[boundary(j) - 1], boundary(j) - boundary(from[j]), type);
+            chunks.push_back({boundary(j), type, nbytes});
+        }
+
+        std::reverse(chunks.begin(), chunks.end());
+    }
+};
+
+/*
+ * Same protocol as the (unchecked) EliasFanoReader: next() before the first value(), and skipTo() never past
+ * the last value of the list.
+ */
+template <typename Value, size_t kSkipQuantum>
+class PartitionedCompression<Value, kSkipQuantum>::Reader
+{
+   public:
+    Reader(size_t bound, size_t size, const uint8_t* buf) : ef(typename ChunkEncoder::CompressedList())
+    {
+        const uint32_t* header = reinterpret_cast<const uint32_t*>(buf);
+
+        nchunks  = header[0];
+        lasts    = header + 1;
+        ends     = header + 1 + nchunks;
+        offsets  = header + 1 + 2 * nchunks;
+        payloads = buf + header_nbytes(nchunks);
+
+        assert(nchunks > 0 and ends[nchunks - 1] == size and lasts[nchunks - 1] == bound);
+    }
+
+    Value value() const
+    {
+        return value_;
+    }
+
+    size_t position() const
+    {
+        return position_;
+    }
+
+    bool next()
+    {
+        if (irg_unlikely(position_ + 1 == end))
+        {
+            enter(chunk + 1);
+            first();
+            return true;
+        }
+
+        position_++;
+
+        if (type == EF)
+        {
+            ef.next();
+            value_ = base + ef.value();
+        }
+        else if (type == RUN)
+        {
+            value_++;
+        }
+        else
+        {
+            bit    = find(bit + 1);
+            value_ = base + bit;
+        }
+
+        return true;
+    }
+
+    bool skipTo(Value v)
+    {
+        if (position_ != size_t(-1) and v <= value_) return true;
+
+        /* Leave the current chunk: find the first one that reaches v. */
+        if (position_ == size_t(-1) or v > lasts[chunk])
+        {
+            enter(std::lower_bound(lasts + (chunk + 1), lasts + nchunks, v) - lasts);
+
+            if (v <= base)
+            {
+                first();
+                return true;
+            }
+
+            if (type == BITMAP)
+            {
+                bit       = find(v - base);
+                position_ = begin + count(0, bit) - 1;
+                value_    = base + bit;
+                return true;
+            }
+        }
+
+        if (type == EF)
+        {
+            ef.skipTo(v - base);
+            position_ = begin + ef.position();
+            value_    = base + ef.value();
+        }
+        else if (type == RUN)
+        {
+            position_ = begin + (v - base);
+            value_    = v;
+        }
+        else
+        {
+            size_t next = find(v - base);
+            position_ += count(bit + 1, next);
+            bit    = next;
+            value_ = base + bit;
+        }
+
+        return true;
+    }
+
+   private:
+    void enter(uint32_t c)
+    {
+        chunk = c;
+        begin = c ? ends[c - 1] : 0;
+        end   = ends[c];
+        base  = c ? lasts[c - 1] + 1 : 0;
+        type  = ChunkType(offsets[c] & 7);
+        data  = payloads + (offsets[c] & ~7u);
+
+        /* (EliasFanoReader is not assignable.) */
+        if (type == EF)
+        {
+            auto list = ChunkLayout::fromUpperBoundAndSize(lasts[c] - base, end - begin).fromList(const_cast<uint8_t*>(data));
+            ef.~ChunkReader();
+            new (&ef) ChunkReader(list);
+        }
+    }
+
+    void first()
+    {
+        position_ = begin;
+
+        if (type == EF)
+        {
+            ef.next();
+            value_ = base + ef.value();
+        }
+        else if (type == RUN)
+        {
+            value_ = base;
+        }
+        else
+        {
+            bit    = find(0);
+            value_ = base + bit;
+        }
+    }
+
+    uint64_t word(size_t w) const
+    {
+        uint64_t x;
+        memcpy(&x, data + 8 * w, sizeof(x));
+        return x;
+    }
+
+    /* The first set bit at or after i; the chunk's last value guarantees there is one. */
+    size_t find(size_t i) const
+    {
+        size_t   w = i / 64;
+        uint64_t x = word(w) & (~uint64_t(0) << (i % 64));
+
+        while (not x) x = word(++w);
+
+        return w * 64 + __builtin_ctzll(x);
+    }
+
+    /* Set bits in [i, j]. */
+    size_t count(size_t i, size_t j) const
+    {
+        size_t wi = i / 64, wj = j / 64;
+        size_t n  = 0;
+
+        for (size_t w = wi; w <= wj; w++)
+        {
+            uint64_t x = word(w);
+            if (w == wi) x &= ~uint64_t(0) << (i % 64);
+            if (w == wj) x &= ~uint64_t(0) >> (63 - j % 64);
+            n += __builtin_popcountll(x);
+        }
+
+        return n;
+    }
+
+    const uint32_t* lasts    = nullptr;
+    const uint32_t* ends     = nullptr;
+    const uint32_t* offsets  = nullptr;
+    const uint8_t*  payloads = nullptr;
+    uint32_t        nchunks  = 0;
+
+    /* The current chunk. */
+    uint32_t       chunk = uint32_t(-1);
+    ChunkType      type  = EF;
+    Value          base  = 0;
+    size_t         begin = 0;
+    size_t         end   = 0;
+    const uint8_t* data  = nullptr;
+    ChunkReader    ef;
+    size_t         bit = 0;
+
+    size_t position_ = size_t(-1);
+    Value  value_    = 0;
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstdint>
+#include <string>
+#include "utils/env.h"
+#include "utils/log.h"
+#include "utils/mmap.h"
+
+/*
+ * Sequential reader over a ds2i-style binary collection file (e.g., index.docs or index.freqs): a
+ * stream of uint32 sequences, each prefixed by its length.
+ *
+ * The file is mapped and sequences are handed out in place, so reading costs no copies and no per-value
+ * calls. Pages behind the cursor are dropped every ReleaseQuantum bytes, which keeps the resident set
+ * at the read-ahead window no matter how large the input is.
+ */
+class PostingStream
+{
+   public:
+    static constexpr size_t ReleaseQuantum = size_t(256) << 20;
+
+    void open(const std::string &path)
+    {
+        this->path = path;
+        file.open(path);
+        file.advise(MADV_SEQUENTIAL);
+
+        position = 0;
+        released = 0;
+    }
+
+    void close()
+    {
+        file.close();
+    }
+
+    /* Returns false at the end of the file; exits on a truncated sequence. */
+    bool next(const uint32_t *&values, uint32_t &length)
+    {
+        if (position + sizeof(uint32_t) > file.size()) return false;
+
+        length = *reinterpret_cast<const uint32_t *>(file.data() + position);
+        position += sizeof(uint32_t);
+
+        if (position + uint64_t(length) * sizeof(uint32_t) > file.size())
+        {
+            LOG.info("Truncated sequence in %s at byte %lu\n", path.c_str(), position);
+            Env::exit(1);
+        }
+
+        values = reinterpret_cast<const uint32_t *>(file.data() + position);
+        position += uint64_t(length) * sizeof(uint32_t);
+
+        return true;
+    }
+
+    /* Drops the pages entirely before still_needed (i.e., those of the sequences already consumed). */
+    void release_consumed(const uint32_t *still_needed)
+    {
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t upto = (reinterpret_cast<const uint8_t *>(still_needed) - file.data()) / page * page;
+
+        if (upto >= released + ReleaseQuantum)
+        {
+            madvise(file.data() + released, upto - released, MADV_DONTNEED);
+            released = upto;
+        }
+    }
+
+    size_t nbytes_read() const
+    {
+        return position;
+    }
+
+    size_t nbytes() const
+    {
+        return file.size();
+    }
+
+   private:
+    std::string path;
+    MappedFile  file;
+    size_t      position = 0;
+    size_t      released = 0;
+};
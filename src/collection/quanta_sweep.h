@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include "collection/doc_ids.h"
+#include "collection/rectangular_matrix.h"
+
+/*
+ * Replays the traced next_geq() calls (TRACE_NEXT_GEQ) against the traced terms' doc IDs, re-encoded with each
+ * candidate skip quantum, and reports the cost per call and the space overhead of each. Every cursor is first
+ * moved (untimed) to where it was when the call was made, so only the jumps themselves are measured.
+ */
+template <size_t kSkipQuantum>
+void sweep_skip_quantum(RectangularMatrix<EdgeWeight>& A, const std::vector<NextGeqCall>& trace)
+{
+    using Candidate = Compression<uint32_t, kSkipQuantum, DOCS_FORWARD_QUANTUM>;
+
+    DocIDsReader doc_ids_reader{A.doc_ids};
+
+    std::vector<uint32_t> terms;
+    for (auto& call : trace) terms.push_back(call.term);
+    std::sort(terms.begin(), terms.end());
+    terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+
+    /* Re-encode the traced lists. */
+    std::vector<size_t>   offsets(terms.size() + 1, 0);
+    std::vector<uint8_t>  buf;
+    std::vector<uint32_t> tmp;
+
+    for (size_t i = 0; i < terms.size(); i++)
+    {
+        uint32_t local_df = A.terms[terms[i]].local_df;
+        auto     reader   = doc_ids_reader.get_docs(terms[i], local_df);
+
+        tmp.clear();
+        for (uint32_t j = 0; j <= local_df; j++)
+        {
+            reader.next();
+            tmp.push_back(reader.value());
+        }
+
+        offsets[i + 1] = offsets[i] + Candidate::encoded_nbytes(A.rank_ndocs, tmp.size());
+        buf.resize(offsets[i + 1] + 7);
+        Candidate::encode(tmp, buf.data() + offsets[i]);
+    }
+
+    std::vector<typename Candidate::Reader> readers;
+    readers.reserve(trace.size());
+
+    for (auto& call : trace)
+    {
+        size_t i = std::lower_bound(terms.begin(), terms.end(), call.term) - terms.begin();
+
+        readers.push_back(Candidate::reader(A.rank_ndocs, A.terms[call.term].local_df + 1, buf.data() + offsets[i]));
+        readers.back().next();
+        readers.back().skipTo(call.from);
+    }
+
+    uint64_t checksum = 0;
+    double   t        = Env::now();
+
+    for (size_t i = 0; i < trace.size(); i++)
+    {
+        readers[i].skipTo(trace[i].target);
+        checksum += readers[i].value();
+    }
+
+    t = Env::now() - t;
+
+    LOG.info("Skip quantum %4lu: %.1f ns/next_geq, %.3f GiBs for the traced lists (checksum %lu)\n", kSkipQuantum,
+             t * 1e9 / trace.size(), offsets.back() / 1024.0 / 1024.0 / 1024.0, checksum);
+}
+
+void sweep_skip_quanta(RectangularMatrix<EdgeWeight>& A)
+{
+    std::vector<NextGeqCall>& trace = next_geq_trace();
+
+    if (trace.empty())
+    {
+        LOG.info("No next_geq() calls were traced\n");
+        return;
+    }
+
+    /* The distance distribution the sweep is replaying, in powers of two. */
+    std::vector<uint64_t> histogram(33, 0);
+    for (auto& call : trace) histogram[64 - __builtin_clzll(uint64_t(call.target - call.from))]++;
+
+    LOG.info("Traced %lu next_geq() calls; distances:\n", trace.size());
+    for (uint32_t b = 1; b < histogram.size(); b++)
+    {
+        if (histogram[b]) LOG.info("  [2^%02u, 2^%02u): %5.2f%%\n", b - 1, b, 100.0 * histogram[b] / trace.size());
+    }
+
+    sweep_skip_quantum<0>(A, trace);
+    sweep_skip_quantum<32>(A, trace);
+    sweep_skip_quantum<64>(A, trace);
+    sweep_skip_quantum<128>(A, trace);
+    sweep_skip_quantum<256>(A, trace);
+    sweep_skip_quantum<512>(A, trace);
+    sweep_skip_quantum<1024>(A, trace);
+}
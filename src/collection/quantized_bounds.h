@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include "utils/common.h"
+
+static_assert(BOUND_BITS == 4 or BOUND_BITS == 8 or BOUND_BITS == 16, "BOUND_BITS must be 4, 8 or 16");
+
+/*
+ * Block bounds as BOUND_BITS-bit codes on a per-term scale z = term bound / MaxCode. Codes round up, so the
+ * decoded bound z * q + 0.0001 never falls below the bound it encodes, and q = 0 is reserved for empty blocks.
+ * 16- and 8-bit codes take a word each; 4-bit codes are packed two to a byte, the even one in the low nibble.
+ */
+struct QuantizedBounds
+{
+    using Code = typename std::conditional<BOUND_BITS == 16, uint16_t, uint8_t>::type;
+
+    static constexpr uint32_t Bits         = BOUND_BITS;
+    static constexpr uint32_t MaxCode      = (1u << Bits) - 1;
+    static constexpr uint32_t CodesPerWord = (Bits == 4) ? 2 : 1;
+
+    /* Words for a row of n codes. */
+    static size_t nwords(size_t n)
+    {
+        return (n + CodesPerWord - 1) / CodesPerWord;
+    }
+
+    static float scale(float term_bound)
+    {
+        return term_bound / MaxCode;
+    }
+
+    static uint32_t encode(float bound, float z)
+    {
+        if (not(bound > 0.000000001)) return 0;
+        return std::min(MaxCode, uint32_t(std::max(1, int(std::ceil(bound / z)))));
+    }
+
+    static float decode(uint32_t q, float z)
+    {
+        return q ? (z * q + 0.0001) : 0.0f;
+    }
+
+    /* Encodes a row of n bounds. */
+    static void encode_row(const float *bounds, size_t n, float z, Code *codes)
+    {
+        for (size_t j = 0; j < n; j++)
+        {
+            uint32_t q = encode(bounds[j], z);
+            set(codes, j, q);
+
+            if (decode(q, z) < bounds[j])
+            {
+                LOG.info("%u, %f, %f, %f\n", q, decode(q, z), bounds[j], z * MaxCode);
+                Env::exit(0);
+            }
+        }
+    }
+
+    static uint32_t get(const Code *row, size_t j)
+    {
+#if BOUND_BITS == 4
+        return (row[j >> 1] >> ((j & 1) << 2)) & 15;
+#else
+        return row[j];
+#endif
+    }
+
+    static void set(Code *row, size_t j, uint32_t q)
+    {
+#if BOUND_BITS == 4
+        uint32_t shift = (j & 1) << 2;
+        row[j >> 1]    = (row[j >> 1] & ~(15u << shift)) | (q << shift);
+#else
+        row[j] = q;
+#endif
+    }
+};
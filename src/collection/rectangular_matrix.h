@@ -2,12 +2,19 @@
 
 #include <math.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <cassert>
 #include <vector>
 #include "api/bm25.h"
+#include "collection/block_bounds.h"
 #include "collection/doc_ids.h"
+#include "collection/index_file.h"
+#include "collection/quantized_bounds.h"
+#include "collection/sparse_bounds.h"
 #include "collection/stats.h"
 #include "structures/fixed_vector.h"
+#include "structures/flat_rows.h"
+#include "structures/mapped_vector.h"
 #include "tsl/sparse_map.h"
 #include "utils/common.h"
 #include "utils/dist_timer.h"
@@ -24,6 +31,7 @@ struct RectangularMatrix
         uint32_t local_df;
         uint32_t local_cf;
         uint32_t term_idx;
+        uint32_t padding = 0; /* Explicit, so the saved terms are byte-for-byte reproducible. */
     };
 
 
@@ -38,12 +46,12 @@ struct RectangularMatrix
     /* Statistics (for collection, *local* terms, and *local* docs). */
     CollectionStats                       collection_stats;
     std::vector<TermStats>                user_term_stats;
-    std::vector<StaticDocStats>           static_doc_stats;
+    MappedVector<StaticDocStats>          static_doc_stats;
     std::vector<ChosenTerm2Doc::DocStats> doc_stats;
 
     /* Compressed Edges. */
     std::vector<size_t> cbounds_offsets;
-    std::vector<Term>   terms;
+    MappedVector<Term>  terms;
     DocIDs              doc_ids;
 
 /* Weights. */
@@ -61,26 +69,44 @@ struct RectangularMatrix
     float                             index_ub;
     std::vector<std::vector<Message>> cache;
     std::vector<Message>              bounds;
-    std::vector<SelfMessage>          doc_bounds;
-    std::vector<SelfMessage>          doc_messages;
+    MappedVector<SelfMessage>         doc_bounds;
+    MappedVector<SelfMessage>         doc_messages;
 
     std::vector<bool> shard_exists;
 
+    /* Backing storage of the mapped arrays above (with CACHE_MMAP). */
+    IndexFile index_file;
+
+    /* Backing storage of the bounds below, when loaded from their cache (see bounds_cache.h). */
+    IndexFile bounds_file;
+
     /* MaxScore! FIXME: ! */
-    std::vector<Message>               maxscores;
-    
-    std::vector<std::vector<uint8_t>>  qmaxscores;
-    std::vector<std::vector<Message>>  bmw_maxscores;
-    std::vector<std::vector<Message>>  doc_maxscores;
-    std::vector<std::vector<uint32_t>> bmw_wdoc;
-    std::vector<std::vector<uint32_t>> bmw_sdoc;
+    MappedVector<Message> maxscores;
     
+    /* Per-term block bounds, one row per term: of its doc ranges (qmaxscores, long lists only), and of its blocks
+     * of postings, or VBMW partitions (bmw_qmaxscores, ending at bmw_wdoc). */
+    FlatRows<QuantizedBounds::Code> qmaxscores;
+    FlatRows<QuantizedBounds::Code> bmw_qmaxscores;
+    FlatRows<Message>  doc_maxscores;
+    FlatRows<uint32_t> bmw_wdoc;
+    FlatRows<uint32_t> bmw_sdoc;
+
+    /* Doc ranges per dense block bound (log2), per term: tuned on the query log or by df (see block_tuner.h). */
+    MappedVector<uint8_t> block_shifts;
+
+    /* The doc-range bounds of short lists, which have no rows in the dense ones above. */
+    SparseRangeBounds sparse_bounds;
+
+    /* Level l of the pyramid bounds ranges of 1 << (PYRAMID_RADIX * (l + 1)) fine ranges (see build_range_pyramid). */
+    FlatRows<Message>         pyramid_maxscores[PYRAMID_LEVELS];
+    MappedVector<SelfMessage> pyramid_doc_bounds[PYRAMID_LEVELS];
+
     SelfMessage                        global_doc_bound;
     std::vector<std::vector<uint32_t>> fwd;
     std::vector<std::vector<uint32_t>> fwd_freq;
 
-    RectangularMatrix(uint32_t global_ndocs, uint32_t rank_ndocs_, uint32_t nterms, uint64_t ub_rank_ntriples)
-        : nterms(nterms), rank_ndocs(rank_ndocs_), doc_ids(rank_ndocs_, ub_rank_ntriples)
+    RectangularMatrix(uint32_t global_ndocs, uint32_t rank_ndocs_, uint32_t nterms)
+        : nterms(nterms), rank_ndocs(rank_ndocs_), doc_ids(rank_ndocs_)
     {
         assert(rank_ndocs > 0);
         assert(global_ndocs >= rank_ndocs);
@@ -92,7 +118,79 @@ struct RectangularMatrix
         // doc_stats.resize(rank_ndocs);
     }
 
+    std::string index_path() const
+    {
+        return CachePrefix + std::to_string(Env::rank) + ".index.bin";
+    }
+
     void load()
+    {
+        /* Caches from before the index container: read the loose files once, and rewrite them. */
+        if (access(index_path().c_str(), F_OK) != 0)
+        {
+            LOG.info("No %s, converting the legacy cache files ...\n", index_path().c_str());
+            load_legacy();
+            save();
+
+            /* Reloaded from the container below, in place or as a copy of its own. */
+            doc_ids.release_legacy();
+        }
+
+        index_file.open(index_path(), CACHE_MMAP_POPULATE);
+
+        for (auto id : {TERMS, DOC_STATS, COLLECTION_STATS, DOCS_NTERMS, DOCS_OFFSETS, FREQS_OFFSETS})
+        {
+            if (not index_file.verify(id))
+            {
+                LOG.info("Checksum mismatch in section %u of %s\n", id, index_path().c_str());
+                Env::exit(1);
+            }
+        }
+
+        for (auto id : {DIRECTORY, CODEC})
+        {
+            if (index_file.has(id) and not index_file.verify(id))
+            {
+                LOG.info("Checksum mismatch in section %u of %s\n", id, index_path().c_str());
+                Env::exit(1);
+            }
+        }
+
+#if CACHE_VERIFY_POSTINGS
+        if (not index_file.verify(DOCS) or not index_file.verify(FREQS))
+        {
+            LOG.info("Checksum mismatch in the postings of %s\n", index_path().c_str());
+            Env::exit(1);
+        }
+#endif
+
+        size_t          n;
+        StaticDocStats *doc_stats_ = index_file.array<StaticDocStats>(DOC_STATS, n);
+        if (n != static_doc_stats.size()) index_file.fail("doc stats for another number of docs");
+
+        Term *terms_ = index_file.array<Term>(TERMS, n);
+
+#if CACHE_MMAP
+        /* Use static_doc_stats and terms in place. */
+        static_doc_stats.view(doc_stats_, static_doc_stats.size());
+        terms.view(terms_, n);
+        index_file.advise(TERMS, MADV_WILLNEED);
+#else
+        std::copy(doc_stats_, doc_stats_ + static_doc_stats.size(), static_doc_stats.begin());
+        terms.resize(n);
+        std::copy(terms_, terms_ + n, terms.begin());
+#endif
+
+        collection_stats = index_file.value<CollectionStats>(COLLECTION_STATS);
+
+        doc_ids.load(index_file);
+
+#if not CACHE_MMAP
+        index_file.close();
+#endif
+    }
+
+    void load_legacy()
     {
         std::string prefix{CachePrefix};
 
@@ -116,22 +214,6 @@ struct RectangularMatrix
         fread(terms.data(), terms.size() * sizeof(Term), 1, f);
         fclose(f);
 
-        // std::vector<uint32_t> buckets(32);
-        // for (auto &t : terms)
-        // {
-        //     uint32_t b = std::log(t.local_df) / std::log(2);
-        //     buckets[b]++;
-        // }
-
-        // size_t sum = 0;
-        // for (int b = 31; b >= 0; b--)
-        // {
-        //     sum += buckets[b];
-        //     LOG.info("Bucket >= %u:    %u\n", 1 << b, sum);
-        // }
-
-        // Env::exit(0);
-
         /* Load collection_stats. */
         s = (prefix + std::to_string(Env::rank) + ".collection_stats.bin");
         f = fopen(s.c_str(), "r");
@@ -141,9 +223,7 @@ struct RectangularMatrix
         assert(r == 1);
         fclose(f);
 
-        doc_ids.load();
-
-        // return true;
+        doc_ids.load_legacy();
     }
 
     void save()
@@ -151,28 +231,12 @@ struct RectangularMatrix
         std::string prefix{CachePrefix};
         mkdir(prefix.c_str(), 777);
 
-        /* Save static_doc_stats. */
-        FILE *f = fopen((prefix + std::to_string(Env::rank) + ".doc_stats.bin").c_str(), "w");
-        assert(f != NULL);
-        size_t r = fwrite(static_doc_stats.data(), static_doc_stats.size(), sizeof(StaticDocStats), f);
-        // assert(r == 1);
-        fclose(f);
-
-        /* TODO: SAVE terms mapping! */
-        f = fopen((prefix + std::to_string(Env::rank) + ".terms.bin").c_str(), "w");
-        assert(f != NULL);
-        r = fwrite(terms.data(), terms.size() * sizeof(Term), 1, f);
-        assert(r == 1);
-        fclose(f);
-
-        /* Save collection_stats. */
-        f = fopen((prefix + std::to_string(Env::rank) + ".collection_stats.bin").c_str(), "w");
-        assert(f != NULL);
-        r = fwrite(&collection_stats, sizeof(collection_stats), 1, f);
-        assert(r == 1);
-        fclose(f);
-
-        doc_ids.save();
+        IndexFileWriter writer(index_path());
+        writer.add_array(DOC_STATS, static_doc_stats.data(), static_doc_stats.size());
+        writer.add_array(TERMS, terms.data(), terms.size());
+        writer.add_value(COLLECTION_STATS, collection_stats);
+        doc_ids.save(writer);
+        writer.write();
     }
 
     uint32_t rank_nshards()
@@ -180,24 +244,70 @@ struct RectangularMatrix
         return ((rank_ndocs - 1) >> SHARD_RADIX) + 1;
     }
 
-    void add_triple(WTriple &triple)
+    /* Groups doc_bounds into the levels of pyramid_doc_bounds, with the model's ubound(). */
+    template <class Model>
+    void build_doc_bound_pyramid(Model &model)
     {
-        collection_stats.ntokens += triple.weight;
-        static_doc_stats[triple.doc].degree++;
-        static_doc_stats[triple.doc].len += triple.weight;
+        for (uint32_t l = 0; l < PYRAMID_LEVELS; l++)
+        {
+            auto &below = l ? pyramid_doc_bounds[l - 1] : doc_bounds;
+            auto &level = pyramid_doc_bounds[l];
+
+            level.clear();
+            level.resize(((below.size() - 1) >> PYRAMID_RADIX) + 1);
+            for (size_t r = 0; r < below.size(); r++)
+                level[r >> PYRAMID_RADIX] = model.ubound(level[r >> PYRAMID_RADIX], below[r]);
+        }
     }
 
-    void add_term(uint32_t term, const std::vector<WTriple> &triples)
+    /*
+     * Adds a batch of terms read from the input: document statistics count every term, while only the needed
+     * ones are kept and encoded. Both passes run on all threads; cf is filled in for each span.
+     */
+    void add_terms(std::vector<PostingSpan> &batch, const std::vector<bool> &needed)
     {
-        assert(term < nterms);
+        uint64_t ntokens = 0;
+
+#pragma omp parallel for schedule(dynamic, 1) reduction(+ : ntokens)
+        for (size_t t = 0; t < batch.size(); t++)
+        {
+            auto &   span     = batch[t];
+            uint64_t local_cf = 0;
+
+            for (uint32_t i = 0; i < span.df; i++)
+            {
+                assert(span.docs[i] < rank_ndocs);
+                assert(span.freqs[i] > 0);
 
-        uint64_t local_cf = 0;
-        for (auto &t : triples) local_cf += t.weight;
-        assert(local_cf < (1lu << 32));
+                local_cf += span.freqs[i];
 
-        terms.push_back({0, 0, uint32_t(triples.size()), uint32_t(local_cf), term});
+                auto &stats = static_doc_stats[span.docs[i]];
+#pragma omp atomic
+                stats.degree++;
+#pragma omp atomic
+                stats.len += span.freqs[i];
+            }
+
+            assert(local_cf < (1lu << 32));
+            span.cf = local_cf;
+            ntokens += local_cf;
+        }
+
+        collection_stats.ntokens += ntokens;
+
+        std::vector<PostingSpan> kept;
+        for (size_t t = 0; t < batch.size(); t++)
+        {
+            auto &span = batch[t];
+            assert(span.term < nterms);
+
+            if (not needed[t] or span.df == 0) continue;
+
+            terms.push_back({0, 0, span.df, span.cf, span.term});
+            kept.push_back(span);
+        }
 
-        doc_ids.add_term(triples);
+        doc_ids.add_terms(kept);
     }
 
     void finalize(bool recreate)
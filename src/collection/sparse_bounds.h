@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "collection/quantized_bounds.h"
+#include "structures/flat_rows.h"
+
+/*
+ * Doc-range bounds of the short lists (local_df < MaxDF), which are nonzero in at most local_df of the
+ * rank_ndocs >> SHARD_RADIX ranges: per term, the ranges it occurs in, ascending, and their quantized bounds.
+ * A Cursor walks a term's ranges forward, so a pass over the ranges in order costs O(nonzero ranges).
+ */
+struct SparseRangeBounds
+{
+    using Code = QuantizedBounds::Code;
+
+    static constexpr uint32_t MaxDF = 1 << 15;
+
+    FlatRows<uint32_t> ranges;
+    FlatRows<Code>     codes;
+
+    class Cursor
+    {
+       public:
+        Cursor() {}
+
+        Cursor(const uint32_t *ranges, const Code *codes, size_t n, float z) : ranges(ranges), codes(codes), n(n), z(z)
+        {
+        }
+
+        /* The current nonzero range, or UINT32_MAX past the last. */
+        uint32_t range() const
+        {
+            return pos < n ? ranges[pos] : UINT32_MAX;
+        }
+
+        float bound() const
+        {
+            return QuantizedBounds::decode(QuantizedBounds::get(codes, pos), z);
+        }
+
+        void next()
+        {
+            pos++;
+        }
+
+        /* Moves to the first nonzero range >= target (never backwards). */
+        void next_geq(uint32_t target)
+        {
+            if (range() < target) pos = std::lower_bound(ranges + pos + 1, ranges + n, target) - ranges;
+        }
+
+        /* Adds to ubs[g - begin], for each group g in [begin, end) of 1 << shift ranges, the max bound of the
+         * nonzero ranges in it (never backwards: the groups of later calls are after these). */
+        template <class Bound>
+        void add_group_bounds(Bound *ubs, uint32_t begin, uint32_t end, uint32_t shift)
+        {
+            const uint64_t last = uint64_t(end) << shift;
+
+            next_geq(begin << shift);
+
+            while (range() < last)
+            {
+                uint32_t group = range() >> shift;
+                float    b     = bound();
+
+                for (next(); range() < last and (range() >> shift) == group; next()) b = std::max(b, bound());
+
+                ubs[group - begin] += b;
+            }
+        }
+
+       private:
+        const uint32_t *ranges = nullptr;
+        const Code *    codes  = nullptr;
+        size_t          n      = 0;
+        size_t          pos    = 0;
+        float           z      = 0.0f;
+    };
+
+    Cursor cursor(uint32_t idx, float z) const
+    {
+        return Cursor(ranges[idx], codes[idx], ranges.row_size(idx), z);
+    }
+
+    /* Random access, by binary search over the term's ranges. */
+    float bound(uint32_t idx, float z, uint32_t range) const
+    {
+        Cursor c = cursor(idx, z);
+        c.next_geq(range);
+
+        return c.range() == range ? c.bound() : 0.0f;
+    }
+
+    /*
+     * The nonzero ranges of the short lists as optimize_model() finds them, from several threads and without an
+     * allocation per term: each thread appends its terms' to buffers of its own, and assign() then copies them
+     * into rows, which can only be sized once all are known.
+     */
+    class Staging
+    {
+       public:
+        Staging(size_t nterms, uint32_t nthreads) : buffers(nthreads), terms(nterms) {}
+
+        /* Term idx's ranges are staged by thread from here on, in ascending order. */
+        void start(uint32_t idx, uint32_t thread)
+        {
+            terms[idx] = {thread, buffers[thread].ranges.size(), 0};
+        }
+
+        /* Raises term idx's bound in range, which is its last staged range or one after it. */
+        void add(uint32_t idx, uint32_t range, float bound)
+        {
+            auto &t   = terms[idx];
+            auto &buf = buffers[t.thread];
+
+            if (t.count == 0 or buf.ranges.back() != range)
+            {
+                buf.ranges.push_back(range);
+                buf.bounds.push_back(0.0f);
+                t.count++;
+            }
+
+            buf.bounds.back() = std::max(buf.bounds.back(), bound);
+        }
+
+       private:
+        friend struct SparseRangeBounds;
+
+        struct Buffers
+        {
+            std::vector<uint32_t> ranges;
+            std::vector<float>    bounds;
+        };
+
+        struct Term
+        {
+            uint32_t thread;
+            size_t   begin;
+            size_t   count;
+        };
+
+        std::vector<Buffers> buffers;
+        std::vector<Term>    terms;
+    };
+
+    /* Per term, its staged ranges and their bounds, encoded on the scale of its term bound. */
+    template <class TermBounds>
+    void assign(const Staging &staged, const TermBounds &term_bounds)
+    {
+        auto count = [&](size_t i) { return staged.terms[i].count; };
+
+        ranges.reset(staged.terms.size(), count);
+        codes.reset(staged.terms.size(), [&](size_t i) { return QuantizedBounds::nwords(count(i)); });
+
+        for (size_t i = 0; i < staged.terms.size(); i++)
+        {
+            auto &t   = staged.terms[i];
+            auto &buf = staged.buffers[t.thread];
+            auto  z   = QuantizedBounds::scale(term_bounds[i]);
+
+            std::copy_n(buf.ranges.data() + t.begin, t.count, ranges[i]);
+            QuantizedBounds::encode_row(buf.bounds.data() + t.begin, t.count, z, codes[i]);
+        }
+    }
+};
@@ -2,8 +2,8 @@
 
 #include <math.h>
 #include <algorithm>
-#include <deque>
-#include <iterator>
+#include <cassert>
+#include <cstdint>
 #include <vector>
 
 namespace ds2i
@@ -11,155 +11,63 @@ namespace ds2i
 typedef uint32_t posting_t;
 typedef float    wand_cost_t;
 
-struct score_opt_partition
+/*
+ * Score-optimal (VBMW) partitioning of a list's scores into blocks, with one partitioner per thread: all of its
+ * buffers are kept across lists, so a partitioner stops allocating once it has seen its largest list.
+ */
+struct score_opt_partitioner
 {
-    std::vector<uint32_t> partition;
-    std::vector<uint32_t> docids;
-    std::vector<uint32_t> sizes;
-    std::vector<float>    max_values;
-    std::vector<float>    errors;
-    wand_cost_t           cost_opt = 0;  // the costs are in bits!
-
-    template <typename ForwardIterator>
-    struct score_window
+    /* The blocks of the last list partitioned: the end position, last doc and max score of each. */
+    std::vector<posting_t> partition;
+    std::vector<uint32_t>  docids;
+    std::vector<float>     max_values;
+    wand_cost_t            cost_opt = 0;
+
+    /* Partitions the postings docs[0, size) of scores[0, size) (size >= 1). */
+    void run(const uint32_t* docs, const float* scores, posting_t size, float fixed_cost)
     {
-        // a window represent the cost of the interval [start, end)
-        ForwardIterator start_it;
-        ForwardIterator end_it;
-        // starting and ending position of the window
-        posting_t         start = 0;
-        posting_t         end   = 0;  // end-th position is not in the current window
-        posting_t         min_p = 0;
-        posting_t         max_p = 0;
-        wand_cost_t       cost_upper_bound;  // The maximum cost for this window
-        std::deque<float> max_queue;
-        float             m_fixed_cost;
-        float             sum;
-        uint64_t          end_sequence;
-        uint64_t          element_count;
-        float             estimated_idf;
-
-        score_window(ForwardIterator begin, posting_t base, wand_cost_t cost_upper_bound, float fixed_cost, size_t size,
-                     float e_idf)
-            : start_it(begin),
-              end_it(begin),
-              min_p(base),
-              max_p(0),
-              cost_upper_bound(cost_upper_bound),
-              m_fixed_cost(fixed_cost),
-              sum(0),
-              end_sequence(size),
-              element_count(0),
-              estimated_idf(e_idf)
-        {
-        }
-
-        uint64_t universe() const
-        {
-            return max_p - min_p + 1;
-        }
-
-        uint64_t size() const
-        {
-            return end - start;
-        }
-
-        void advance_start()
-        {
-            float v = std::get<1>(*start_it) * estimated_idf;
-            if (std::get<1>(*start_it) == max_queue.front()) max_queue.pop_front();
-
-            sum -= v;
-            ++start;
-            ++start_it;
-            if (std::get<1>(*start_it) != 0) ++element_count;
-        }
-
-        void advance_end()
-        {
-            float v = std::get<1>(*end_it) * estimated_idf;
-            sum += v;
-
-            while (max_queue.size() > 0 && max_queue.back() < std::get<1>(*end_it))
-            {
-                max_queue.pop_back();
-            }
-
-            max_queue.push_back(std::get<1>(*end_it));
-            // max_p = *end_it;
-            ++end;
-            ++end_it;
-            if (std::get<1>(*end_it) != 0) --element_count;
-        }
-
-        float cost()
-        {
-            if (size() < 2)
-                return m_fixed_cost;
-            else
-                return size() * max_queue.front() * estimated_idf - sum + m_fixed_cost;
-        }
-
-        float max()
-        {
-            return max_queue.front();
-        }
-    };
-
-    score_opt_partition()
-    {
-    }
-
-    template <typename ForwardIterator>
-    score_opt_partition(ForwardIterator begin, uint64_t size, float fixed_cost)
-    {
-        double eps1       = 0.01;
-        double eps2       = 0.4;
-
-        uint32_t base          = 0;
-        float    estimated_idf = 1.0;
+        double eps1 = 0.01;
+        double eps2 = 0.4;
 
         // compute cost of single block.
         float max = 0;
         float sum = 0;
-        std::for_each(begin, begin + size, [&](auto& b) {
-            max = std::max(max, std::get<1>(b));
-            sum += std::get<1>(b) * estimated_idf;
-        });
+        for (posting_t i = 0; i < size; i++)
+        {
+            max = std::max(max, scores[i]);
+            sum += scores[i];
+        }
 
-        wand_cost_t              single_block_cost = size * max * estimated_idf - sum;
-        std::vector<wand_cost_t> min_cost(size + 1, single_block_cost);
+        wand_cost_t single_block_cost = size * max - sum;
+        min_cost.assign(size + 1, single_block_cost);
         min_cost[0] = 0;
 
         // create the required window: one for each power of approx_factor
-        std::vector<score_window<ForwardIterator>> windows;
-        wand_cost_t                                cost_lb    = fixed_cost;
-        wand_cost_t                                cost_bound = cost_lb;
+        size_t      nwindows   = 0;
+        wand_cost_t cost_lb    = fixed_cost;
+        wand_cost_t cost_bound = cost_lb;
         while (eps1 == 0 || cost_bound < cost_lb / eps1)
         {
-            windows.emplace_back(begin, base, cost_bound, fixed_cost, size, estimated_idf);
+            if (windows.size() == nwindows) windows.emplace_back();
+            windows[nwindows++].reset(scores, cost_bound, fixed_cost);
+
             if (cost_bound >= single_block_cost) break;
             cost_bound = cost_bound * (1 + eps2);
         }
 
-        std::vector<posting_t> path(size + 1, 0);
-        std::vector<float>     maxs(size + 1, 0);
-
-        auto max1  = std::max_element(begin, begin + size, [](const auto& lhs, const auto& rhs) -> auto {
-            return std::get<1>(lhs) < std::get<1>(rhs);
-        });
-        maxs[size] = std::get<1>(*max1);
+        path.assign(size + 1, 0);
+        maxs.assign(size + 1, 0);
+        maxs[size] = max;
 
         for (posting_t i = 0; i < size; i++)
         {
             size_t last_end = i + 1;
-            for (auto& window : windows)
+            for (size_t w = 0; w < nwindows; w++)
             {
+                auto& window = windows[w];
+
                 assert(window.start == i);
-                while (window.end < last_end)
-                {
-                    window.advance_end();
-                }
+                while (window.end < last_end) window.advance_end();
 
                 wand_cost_t window_cost;
                 while (true)
@@ -182,34 +90,103 @@ struct score_opt_partition
             }
         }
 
-        posting_t          curr_pos = size;
-        std::vector<float> max_values_temp;
-        while (curr_pos != 0)
-        {
-            partition.push_back(curr_pos);
-            max_values_temp.push_back(maxs[curr_pos]);
-            errors.push_back(min_cost[curr_pos] / ((float)curr_pos / path[curr_pos]));
-            curr_pos = path[curr_pos];
-        }
-
+        partition.clear();
+        for (posting_t curr_pos = size; curr_pos != 0; curr_pos = path[curr_pos]) partition.push_back(curr_pos);
         std::reverse(partition.begin(), partition.end());
-        std::reverse(max_values_temp.begin(), max_values_temp.end());
-        std::reverse(errors.begin(), errors.end());
 
-        uint32_t current = 0;
+        docids.clear();
+        max_values.clear();
         for (size_t i = 0; i < partition.size() - 1; i++)
         {
-            docids.push_back(std::get<0>(*(begin + partition[i])) - 1);
-            max_values.push_back(max_values_temp[i]);
-            sizes.push_back(partition[i] - current);
-            current = partition[i];
+            docids.push_back(docs[partition[i]] - 1);
+            max_values.push_back(maxs[partition[i]]);
         }
 
-        sizes.push_back(partition[partition.size() - 1] - current);
-        max_values.push_back(max_values_temp[partition.size() - 1]);
-        docids.push_back(std::get<0>(*(begin + size - 1)));
+        max_values.push_back(maxs[partition.back()]);
+        docids.push_back(docs[size - 1]);
         cost_opt = min_cost[size];
     }
+
+   private:
+    // a window represent the cost of the interval [start, end)
+    struct score_window
+    {
+        const float* scores = nullptr;
+        posting_t    start  = 0;
+        posting_t    end    = 0;  // end-th position is not in the current window
+        wand_cost_t  cost_upper_bound;  // The maximum cost for this window
+        float        m_fixed_cost;
+        float        sum;
+
+        /* Monotonic (non-increasing) queue of the window's maxima candidates, in a power-of-two ring. */
+        std::vector<float> ring = std::vector<float>(64);
+        size_t             head = 0;
+        size_t             tail = 0;
+
+        void reset(const float* scores_, wand_cost_t cost_upper_bound_, float fixed_cost)
+        {
+            scores           = scores_;
+            start            = 0;
+            end              = 0;
+            cost_upper_bound = cost_upper_bound_;
+            m_fixed_cost     = fixed_cost;
+            sum              = 0;
+            head = tail = 0;
+        }
+
+        uint64_t size() const
+        {
+            return end - start;
+        }
+
+        void advance_start()
+        {
+            if (scores[start] == max()) head++;
+
+            sum -= scores[start];
+            ++start;
+        }
+
+        void advance_end()
+        {
+            float v = scores[end];
+            sum += v;
+
+            while (tail != head and ring[(tail - 1) & (ring.size() - 1)] < v) tail--;
+            if (tail - head == ring.size()) grow();
+
+            ring[tail++ & (ring.size() - 1)] = v;
+            ++end;
+        }
+
+        float cost() const
+        {
+            if (size() < 2)
+                return m_fixed_cost;
+            else
+                return size() * max() - sum + m_fixed_cost;
+        }
+
+        float max() const
+        {
+            return ring[head & (ring.size() - 1)];
+        }
+
+        void grow()
+        {
+            std::vector<float> larger(2 * ring.size());
+            for (size_t k = head; k != tail; k++) larger[k - head] = ring[k & (ring.size() - 1)];
+
+            tail -= head;
+            head = 0;
+            ring.swap(larger);
+        }
+    };
+
+    std::vector<score_window> windows;
+    std::vector<wand_cost_t>  min_cost;
+    std::vector<posting_t>    path;
+    std::vector<float>        maxs;
 };
 
 }  // namespace ds2i
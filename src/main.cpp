@@ -23,6 +23,17 @@
 // #define FILTER_TERMS true
 // #define CACHE_REUSE false
 
+// NOTE: With CACHE_REUSE, map the cache files in place (shared across ranks) instead of reading them.
+#define CACHE_MMAP true
+#define CACHE_MMAP_POPULATE false
+#define CACHE_VERIFY_POSTINGS false
+
+// NOTE: Keep what optimize_model() computes next to the cache, per model, SHARD_RADIX and program (see bounds_cache.h).
+#define CACHE_BOUNDS true
+
+// NOTE: Record every next_geq() of the queries, then replay them against each skip quantum (see quanta_sweep.h).
+#define TRACE_NEXT_GEQ false
+
 #define GlobalPrefix "/datasets2/ClueWeb12_graph/CatB/1x/"
 #define MaxDiskShard 2048
 using EdgeWeight = uint32_t;
@@ -35,49 +46,31 @@ std::vector<uint32_t> all_shards(MaxDiskShard);
 
 #include "collection/collection.h"
 
-#if VBMW
+#if VBMW_BLOCKS
 #include "collection/optimizer.vbmw.h"
 #else
 #include "collection/optimizer.h"
 #endif
 
+#include "qprogram/parallel.h"
+#include "qprogram/planner.h"
 #include "qprogram/qprogram.h"
 #include "qprogram/query.h"
+#include "qprogram/server.h"
+
+#if TRACE_NEXT_GEQ
+#include "collection/quanta_sweep.h"
+#endif
 
 int main(int argc, char **argv)
 {
     Env::init();
 
-#ifdef BMW
-    LOG.info("BMW, SHARD_RADIX=%u\n", SHARD_RADIX);
-#endif
-
-#ifdef LBMW
-    LOG.info("LBMW, SHARD_RADIX=%u\n", SHARD_RADIX);
-#endif
-
-#ifdef VBMW
-    LOG.info("VBMW, SHARD_RADIX=%u, VBMW_COST=%f\n", SHARD_RADIX, VBMW_COST);
-#endif
-
-#ifdef DBMW
-    LOG.info("DBMW, SHARD_RADIX=%u\n", SHARD_RADIX);
-#endif
-
-#ifdef DBMM
-    LOG.info("DBMM, SHARD_RADIX=%u\n", SHARD_RADIX);
-#endif
+    /* The program that runs is logged once it is picked, below. */
+    LOG.info("SHARD_RADIX=%u\n", SHARD_RADIX);
 
-#ifdef MaxScore
-    LOG.info("MaxScore, SHARD_RADIX=%u\n", SHARD_RADIX);
-#endif
-
-#ifdef WAND
-    LOG.info("WAND, SHARD_RADIX=%u\n", SHARD_RADIX);
-#endif
-
-#ifdef LazyMaxScore
-    LOG.info("LazyMaxScore, SHARD_RADIX=%u\n", SHARD_RADIX);
+#if VBMW_BLOCKS
+    LOG.info("VBMW blocks, VBMW_COST=%f\n", VBMW_COST);
 #endif
 
     std::iota(all_shards.begin(), all_shards.end(), 1);
@@ -87,15 +80,16 @@ int main(int argc, char **argv)
     if (Env::nranks > 1) std::random_shuffle(all_shards.begin(), all_shards.end());
 
     /* Command line arguments. */
-    if (argc != 4)
+    if (argc != 4 and argc != 5)
     {
-        LOG.info("Usage: %s <index path> <ndocs> <nterms>\n", argv[0]);
+        LOG.info("Usage: %s <index path> <ndocs> <nterms> [query program]\n", argv[0]);
         Env::exit(0);
     }
 
-    char *   path   = argv[1];
-    uint32_t ndocs  = std::atoi(argv[2]);
-    uint32_t nterms = std::atoi(argv[3]);
+    char *      path    = argv[1];
+    uint32_t    ndocs   = std::atoi(argv[2]);
+    uint32_t    nterms  = std::atoi(argv[3]);
+    std::string program = argc == 5 ? argv[4] : DEFAULT_QUERY_PROGRAM;
 
     std::string Queries_5K = "/datasets/okhattab/queries/mqt_new.txt";
     // std::string Queries_5K = "/datasets/okhattab/queries/PISA_trec_13_14.txt";
@@ -105,14 +99,34 @@ int main(int argc, char **argv)
     optimize_model(C, C.G.A, Queries_5K, nqueries);
 
     /* Set up the Query Program. */
-    QueryProgram qp(C);
-    Query        query(C);
+    const AdaptiveProgram *calibrated = nullptr;
 
-#ifdef DAAT
-    for (uint32_t xx = 0; xx < 1; xx++)
-#else
-    for (uint32_t xx = 0; xx < 2; xx++)
-#endif
+    auto new_query_program = [&]() -> std::unique_ptr<QueryProgramBase> {
+        if (program == "Adaptive")
+        {
+            /* Calibrated once: the programs made after the first share its cost model. */
+            if (calibrated) return calibrated->replicate();
+
+            auto adaptive = new AdaptiveProgram(C, Queries_5K, nqueries);
+            calibrated    = adaptive;
+
+            return std::unique_ptr<QueryProgramBase>(adaptive);
+        }
+
+        if (QUERY_THREADS > 1)
+            return std::unique_ptr<QueryProgramBase>(new ParallelProgram(C, program, QUERY_THREADS));
+
+        return make_query_program(program, C);
+    };
+
+    auto  query_program = new_query_program();
+    auto &qp            = *query_program;
+    Query query(C);
+
+    LOG.info("Query program: %s (%u threads per query)\n", program.c_str(), QUERY_THREADS);
+
+    /* Top-10, then top-1000 (but for exhaustive DAAT, whose cost does not depend on k). */
+    for (uint32_t xx = 0; xx < (program == "DAAT" ? 1u : 2u); xx++)
     { /* Queries. */
         std::ifstream queries_file(Queries_5K);
 
@@ -203,8 +217,35 @@ int main(int argc, char **argv)
         LOG.info("\n Checksum = %.4f\n", checksum);
         LOG.info("Queries_5K = %s\n", Queries_5K.c_str());
 
+        if (program == "Adaptive") static_cast<AdaptiveProgram &>(qp).log_choices();
+
         LOG.info<true, false>("\n\n\n");
     }
 
+    if (QUERY_WORKERS > 1)
+    { /* Throughput: the same queries, QUERY_WORKERS at a time. */
+        std::ifstream queries_file(Queries_5K);
+        std::string   text;
+
+        std::vector<Query> queries(nqueries, Query(C));
+        for (auto &query : queries)
+        {
+            if (Env::is_master) std::getline(queries_file, text);
+            query.from_text(text);
+        }
+
+        QueryServer server(new_query_program, QUERY_WORKERS);
+
+        for (uint32_t k : {10u, 1000u})
+        {
+            float checksum = server.serve(queries, k);
+            LOG.info("Checksum = %.4f\n", checksum);
+        }
+    }
+
+#if TRACE_NEXT_GEQ
+    sweep_skip_quanta(C.G.A);
+#endif
+
     return 0;
 }
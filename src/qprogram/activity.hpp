@@ -1,6 +1,6 @@
 #pragma once
 
-struct QueryProgram::DAAT_Term
+struct QueryProgramBase::DAAT_Term
 {
     uint32_t               idx;
     uint32_t               query_idx;
@@ -10,7 +10,7 @@ struct QueryProgram::DAAT_Term
 };
 
 
-struct QueryProgram::MaxScore_Term
+struct QueryProgramBase::MaxScore_Term
 {
     uint32_t idx;
     uint32_t query_idx;
@@ -21,16 +21,23 @@ struct QueryProgram::MaxScore_Term
     Score         block_maxscore;
     uint32_t      local_df;
     float         z;
+
+    /* LazyMaxScore, for short lists: over the ranges, and over the groups of each pyramid level. */
+    SparseRangeBounds::Cursor range_cursors[PYRAMID_LEVELS + 1];
+
+    /* VBMW_BLOCKS: over the docs scored, and (LazyMaxScore) over the groups of each pyramid level. */
+    BlockBoundCursor block_cursor;
+    BlockBoundCursor level_cursors[PYRAMID_LEVELS + 1];
 };
 
-struct QueryProgram::BMW_Term
+struct QueryProgramBase::BMW_Term
 {
     uint32_t idx;
     uint32_t query_idx;
     EFWrapper     reader;
     UserTermStats idf;
     Message       maxscore;
-    Message *     w;
+    const QuantizedBounds::Code *codes;
     uint32_t *    wdoc;
     uint32_t      local_df;
     uint32_t      widx;
@@ -38,17 +45,29 @@ struct QueryProgram::BMW_Term
     Score         maxscore_cache;
     Score         block_maxscore;
     float         z;
+
+    /* Moves to the block holding doc < rank_ndocs: block widx ends at wdoc[widx], and rows end at rank_ndocs. */
+    void advance_block(uint32_t doc)
+    {
+        while (wdoc[widx] < doc) widx++;
+    }
+
+    /* The bound of block k, decoded as BlockBoundCursor does. */
+    Message block_bound(uint32_t k) const
+    {
+        return QuantizedBounds::decode(QuantizedBounds::get(codes, k), z);
+    }
 };
 
 
-struct QueryProgram::LocalBMW_Term
+struct QueryProgramBase::LocalBMW_Term
 {
     uint32_t idx;
     uint32_t query_idx;
     EFWrapper reader;
     UserTermStats idf;
     Message       maxscore;
-    Message *     w;
+    const QuantizedBounds::Code *codes;
     uint32_t *    wdoc;
     uint32_t      local_df;
     uint32_t      widx;
@@ -56,9 +75,40 @@ struct QueryProgram::LocalBMW_Term
     Score         maxscore_cache;
     Score         block_maxscore;
     Message       ub;
+    float         z;
+
+    Message block_bound(uint32_t k) const
+    {
+        return QuantizedBounds::decode(QuantizedBounds::get(codes, k), z);
+    }
+
+    /* The max bound of the blocks overlapping docs [offset, endpos), which are after those of the last call. */
+    Message local_bound(uint32_t offset, uint32_t endpos)
+    {
+        while (wdoc[widx] < offset) widx++;
+
+        Message bound = block_bound(widx);
+        while (wdoc[widx] < endpos - 1) bound = std::max(bound, block_bound(++widx));
+
+        return bound;
+    }
 };
 
-struct QueryProgram::DocScore
+/* Restores the docid order of enums after enums[i] moved forward. */
+template <class Enum>
+void bubble_down(std::vector<Enum *> &enums, size_t i)
+{
+    for (; i + 1 < enums.size() and enums[i + 1]->reader.docid() < enums[i]->reader.docid(); i++)
+        std::swap(enums[i], enums[i + 1]);
+}
+
+template <class Enum>
+void sort_by_docid(std::vector<Enum *> &enums)
+{
+    std::sort(enums.begin(), enums.end(), [](Enum *a, Enum *b) { return a->reader.docid() < b->reader.docid(); });
+}
+
+struct QueryProgramBase::DocScore
 {
     uint32_t doc;
     Score    score;
@@ -66,12 +116,12 @@ struct QueryProgram::DocScore
     friend bool operator>(const DocScore &a, const DocScore &other);
 };
 
-bool operator>(const QueryProgram::DocScore &a, const QueryProgram::DocScore &other)
+bool operator>(const QueryProgramBase::DocScore &a, const QueryProgramBase::DocScore &other)
 {
     return not(a.score <= other.score);
 }
 
-bool QueryProgram::distributed_topk(bool restore)
+bool QueryProgramBase::distributed_topk(bool restore)
 {
     bool good_case = true;
     topk.clear();
@@ -132,7 +182,7 @@ bool QueryProgram::distributed_topk(bool restore)
     return good_case;
 }
 
-bool QueryProgram::topk_insert(uint32_t doc, Score score)
+bool QueryProgramBase::topk_insert(uint32_t doc, Score score)
 {
     if (irg_unlikely(not(score <= threshold)))
     {
@@ -141,8 +191,49 @@ bool QueryProgram::topk_insert(uint32_t doc, Score score)
         pq.push({doc, score});
 
         threshold = (pq.size() == local_TopK) ? pq.top().score : threshold;
+        if (shared_threshold) share_threshold();
+
         return true;
     }
 
     return false;
+}
+
+/* Publishes this worker's threshold if it is the highest, and takes the highest if not. Both relaxed: a worker
+ * that reads a stale threshold only prunes less, and each publishes only scores its own heap holds k of. */
+void QueryProgramBase::share_threshold()
+{
+    Score shared = shared_threshold->load(std::memory_order_relaxed);
+
+    while (shared < threshold)
+        if (shared_threshold->compare_exchange_weak(shared, threshold, std::memory_order_relaxed)) return;
+
+    threshold = shared;
+}
+
+void QueryProgramBase::take_counters(QueryProgramBase &from)
+{
+    doc_evals += from.doc_evals;
+    send_calls += from.send_calls;
+    pivot_selections += from.pivot_selections;
+    topk_insertions += from.topk_insertions;
+    next_calls += from.next_calls;
+
+    from.doc_evals = from.send_calls = from.pivot_selections = from.topk_insertions = from.next_calls = 0;
+}
+
+EFWrapper QueryProgramBase::open_list(DocIDsReader &doc_ids_reader, uint32_t idx)
+{
+    EFWrapper reader(doc_ids_reader, idx, A.terms[idx].local_df, A.terms[idx].local_cf);
+    if (doc_begin) reader.next_geq(doc_begin);
+
+    return reader;
+}
+
+uint32_t QueryProgramBase::first_block(uint32_t idx) const
+{
+    if (doc_begin == 0) return 0;
+
+    const uint32_t *wdoc = A.bmw_wdoc[idx];
+    return std::lower_bound(wdoc, wdoc + A.bmw_wdoc.row_size(idx), doc_begin) - wdoc;
 }
\ No newline at end of file
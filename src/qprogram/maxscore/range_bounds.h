@@ -0,0 +1,179 @@
+#pragma once
+
+#include <immintrin.h>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "collection/quantized_bounds.h"
+
+/*
+ * Term-at-a-time upper bounds of doc ranges (for LazyMaxScore): each query term's block bounds are added, one
+ * term after the other, into a dense array of ranges, which is then compared against the threshold as a whole.
+ *
+ * Quantized bounds are dequantized on the fly as get_block_bound() does (see quantized_bounds.h), with each code
+ * shared by 1 << shift consecutive ranges. The kernels use AVX-512 or AVX2 when compiled for them
+ * (-march=native), and plain loops otherwise.
+ */
+struct RangeBounds
+{
+    using Code = QuantizedBounds::Code;
+
+    /* acc[j] += row[j], for j < n. */
+    static void add(float* acc, const float* row, size_t n)
+    {
+        size_t j = 0;
+
+#if defined(__AVX512F__)
+        for (; j + 16 <= n; j += 16)
+            _mm512_storeu_ps(acc + j, _mm512_add_ps(_mm512_loadu_ps(acc + j), _mm512_loadu_ps(row + j)));
+#elif defined(__AVX2__)
+        for (; j + 8 <= n; j += 8)
+            _mm256_storeu_ps(acc + j, _mm256_add_ps(_mm256_loadu_ps(acc + j), _mm256_loadu_ps(row + j)));
+#endif
+
+        for (; j < n; j++) acc[j] += row[j];
+    }
+
+    /* acc[j] += the bound of range begin + j, coded at codes[(begin + j) >> shift], for j < n. The shift is at
+     * most MaxBlockShift (see block_tuner.h). */
+    static void add_quantized(float* acc, const Code* codes, uint32_t begin, uint32_t shift, float z, size_t n)
+    {
+        assert(shift <= 2);
+
+        if (shift == 0)
+            add_quantized<0>(acc, codes, begin, z, n);
+        else if (shift == 1)
+            add_quantized<1>(acc, codes, begin, z, n);
+        else
+            add_quantized<2>(acc, codes, begin, z, n);
+    }
+
+    /* Appends begin + j for every acc[j] > threshold, for j < n. */
+    static void candidates(const float* acc, size_t n, float threshold, uint32_t begin, std::vector<uint32_t>& out)
+    {
+        size_t j = 0;
+
+#if defined(__AVX512F__)
+        __m512 t = _mm512_set1_ps(threshold);
+
+        for (; j + 16 <= n; j += 16)
+        {
+            for (uint32_t m = _mm512_cmp_ps_mask(_mm512_loadu_ps(acc + j), t, _CMP_GT_OQ); m; m &= m - 1)
+                out.push_back(begin + j + __builtin_ctz(m));
+        }
+#elif defined(__AVX2__)
+        __m256 t = _mm256_set1_ps(threshold);
+
+        for (; j + 8 <= n; j += 8)
+        {
+            for (uint32_t m = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(acc + j), t, _CMP_GT_OQ)); m; m &= m - 1)
+                out.push_back(begin + j + __builtin_ctz(m));
+        }
+#endif
+
+        for (; j < n; j++)
+            if (acc[j] > threshold) out.push_back(begin + j);
+    }
+
+   private:
+    static float bound(const Code* codes, uint32_t range, uint32_t shift, float z)
+    {
+        return QuantizedBounds::decode(QuantizedBounds::get(codes, range >> shift), z);
+    }
+
+    template <uint32_t kShift>
+    static void add_quantized(float* acc, const Code* codes, uint32_t begin, float z, size_t n)
+    {
+        size_t j = 0;
+
+        /* Up to a range whose code starts a lane group (and, for 4-bit codes, a byte). */
+        for (; j < n and ((begin + j) & ((2u << kShift) - 1)); j++) acc[j] += bound(codes, begin + j, kShift, z);
+
+#if defined(__AVX512F__)
+        constexpr size_t kLanes = 16;
+
+        /* Lane l takes the (l >> kShift)-th of the kLanes >> kShift bounds loaded. */
+        const __m512i spread = _mm512_srli_epi32(_mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0), kShift);
+        const __m512  zs     = _mm512_set1_ps(z);
+        const __m512  eps    = _mm512_set1_ps(0.0001f);
+
+        /* The zero-masked forms throughout: GCC's plain ones merge into an undefined vector, and warn. */
+        for (; j + kLanes <= n; j += kLanes)
+        {
+            __m512i   qi      = load_codes512<(kLanes >> kShift)>(codes, (begin + j) >> kShift);
+            __mmask16 nonzero = _mm512_test_epi32_mask(qi, qi);
+            __m512    b = _mm512_maskz_add_ps(nonzero, _mm512_mul_ps(zs, _mm512_maskz_cvtepi32_ps(nonzero, qi)), eps);
+
+            b = _mm512_maskz_permutexvar_ps(0xFFFF, spread, b);
+            _mm512_storeu_ps(acc + j, _mm512_add_ps(_mm512_loadu_ps(acc + j), b));
+        }
+#elif defined(__AVX2__)
+        constexpr size_t kLanes = 8;
+
+        const __m256i spread = _mm256_srli_epi32(_mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0), kShift);
+        const __m256  zs     = _mm256_set1_ps(z);
+        const __m256  eps    = _mm256_set1_ps(0.0001f);
+        const __m256i zero   = _mm256_setzero_si256();
+
+        for (; j + kLanes <= n; j += kLanes)
+        {
+            __m256i qi = load_codes256<(kLanes >> kShift)>(codes, (begin + j) >> kShift);
+            __m256  b  = _mm256_add_ps(_mm256_mul_ps(zs, _mm256_cvtepi32_ps(qi)), eps);
+
+            b = _mm256_andnot_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(qi, zero)), b);
+            b = _mm256_permutevar8x32_ps(b, spread);
+            _mm256_storeu_ps(acc + j, _mm256_add_ps(_mm256_loadu_ps(acc + j), b));
+        }
+#endif
+
+        for (; j < n; j++) acc[j] += bound(codes, begin + j, kShift, z);
+    }
+
+#if defined(__AVX512F__)
+    /* Codes c to c + count - 1, widened to the low 32-bit lanes. */
+    template <size_t count>
+    static __m512i load_codes512(const Code* codes, size_t c)
+    {
+#if BOUND_BITS == 16
+        uint16_t buf[16] = {};
+        memcpy(buf, codes + c, count * sizeof(uint16_t));
+        return _mm512_maskz_cvtepu16_epi32(0xFFFF, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(buf)));
+#else
+        return _mm512_maskz_cvtepu8_epi32(0xFFFF, load_bytes<count>(codes, c));
+#endif
+    }
+#elif defined(__AVX2__)
+    template <size_t count>
+    static __m256i load_codes256(const Code* codes, size_t c)
+    {
+#if BOUND_BITS == 16
+        uint16_t buf[8] = {};
+        memcpy(buf, codes + c, count * sizeof(uint16_t));
+        return _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(buf)));
+#else
+        return _mm256_cvtepu8_epi32(load_bytes<count>(codes, c));
+#endif
+    }
+#endif
+
+    /* Codes c to c + count - 1 (of at most 8 bits) as bytes in the low lanes, never reading past a row. */
+    template <size_t count>
+    static __m128i load_bytes(const Code* codes, size_t c)
+    {
+        uint8_t buf[16] = {};
+
+#if BOUND_BITS == 4
+        /* c is even: unpack the nibbles, low then high, of count / 2 bytes. */
+        memcpy(buf, codes + c / 2, count / 2);
+
+        __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf));
+        __m128i mask   = _mm_set1_epi8(15);
+
+        return _mm_unpacklo_epi8(_mm_and_si128(packed, mask), _mm_and_si128(_mm_srli_epi16(packed, 4), mask));
+#else
+        memcpy(buf, codes + c, count);
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf));
+#endif
+    }
+};
@@ -0,0 +1,128 @@
+#include "qprogram/query.h"
+
+/*
+ * Block-Max MaxScore, over the blocks of postings of optimize_model() (or VBMW's variable blocks): MaxScore, but
+ * before the non-essential lists are moved to a doc, the bounds of their blocks holding it must exceed the
+ * threshold, and they then bound what is left to score in place of the term bounds.
+ */
+
+template <>
+uint32_t QueryProgram<BMMAlgorithm>::query2terms(const Query &query)
+{
+    /* Cleanup from previous query. */
+    while (not pq.empty()) pq.pop();
+
+    bmw_terms.clear();
+    ub_pfxsum.clear();
+
+    /* Remove UNKs. */
+    qterms.resize(query.terms.size());
+    std::iota(qterms.begin(), qterms.end(), 0);
+
+    auto is_unk = [&](auto idx) { return query.terms[idx] == Collection::UNK; };
+    qterms.erase(std::remove_if(qterms.begin(), qterms.end(), is_unk), qterms.end());
+
+    /*  */
+    uint32_t next_doc = UINT32_MAX;
+
+    std::sort(qterms.begin(), qterms.end(), [&](const auto &a, const auto &b) {
+        return A.terms[query.terms[a]].local_df > A.terms[query.terms[b]].local_df;
+    });
+
+    DocIDsReader doc_ids_reader{A.doc_ids};
+
+    for (auto i : qterms)
+    {
+        uint32_t idx = query.terms[i];
+
+        assert(A.terms[idx].local_df >= 1);
+
+        auto term_stats = UserTermStats(A.collection_stats, A.user_term_stats[idx]);
+
+        bmw_terms.push_back({idx, i, open_list(doc_ids_reader, idx), term_stats,
+                             A.maxscores[idx], A.bmw_qmaxscores[idx], A.bmw_wdoc[idx],
+                             A.terms[idx].local_df, first_block(idx), uint32_t(-1), Score(), Score(),
+                             QuantizedBounds::scale(A.maxscores[idx])});
+
+        next_doc = std::min(next_doc, uint32_t(bmw_terms.back().reader.docid()));
+    }
+
+    return next_doc;
+}
+
+template <>
+void QueryProgram<BMMAlgorithm>::terms2docs(const Query &query, bool reset_threshold)
+{
+    const uint32_t max_doc = doc_end;
+
+    if (reset_threshold) threshold = model.threshold(query.terms.size());
+    uint32_t next_doc              = query2terms(query);
+
+    /* Compute Prefix Sum */
+    global_doc_maxscore = model.self_receive(query.user_terms, A.global_doc_bound);
+
+    ub_pfxsum.push_back(Score());
+    for (auto &t : bmw_terms) ub_pfxsum.push_back(ub_pfxsum.back() + t.maxscore);
+
+    uint32_t optionals = 0;
+
+    while (next_doc < max_doc)
+    {
+        // doc_evals++;
+
+        uint32_t doc = next_doc;
+        next_doc     = UINT32_MAX;
+
+        auto score = model.self_receive(query.user_terms, A.doc_messages[doc]);
+
+        for (uint32_t i = optionals; i < bmw_terms.size(); i++)
+        {
+            auto &t      = bmw_terms[i];
+            auto &reader = t.reader;
+
+            if (reader.docid() == doc)
+            {
+                score += model.send(t.idf, reader.freq(), A.doc_stats[doc]);
+                reader.next();
+            }
+
+            next_doc = std::min(next_doc, uint32_t(reader.docid()));
+        }
+
+        /* Block-max check: the non-essential lists' blocks at doc, before moving any of their readers. */
+        ub_pfxsum1.clear();
+        ub_pfxsum1.push_back(Score());
+
+        for (uint32_t i = 0; i < optionals; i++)
+        {
+            auto &t = bmw_terms[i];
+            t.advance_block(doc);
+            t.block_maxscore = t.block_bound(t.widx);
+            ub_pfxsum1.push_back(ub_pfxsum1.back() + t.block_maxscore);
+        }
+
+        for (int i = int(optionals) - 1; i >= 0; i--)
+        {
+            if (score + ub_pfxsum1[i + 1] <= threshold) break;
+
+            auto &t      = bmw_terms[i];
+            auto &reader = t.reader;
+
+            if (reader.docid() < doc) reader.next_geq(doc);
+
+            if (reader.docid() == doc) score += model.send(t.idf, reader.freq(), A.doc_stats[doc]);
+        }
+
+        if (topk_insert(doc, score))
+        {
+            while (optionals < bmw_terms.size())
+            {
+                if (global_doc_maxscore + ub_pfxsum[optionals + 1] <= threshold)
+                    optionals++;
+
+                else
+                    break;
+            }
+        }
+    }
+}
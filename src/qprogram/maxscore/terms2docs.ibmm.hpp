@@ -0,0 +1,109 @@
+#include "qprogram/query.h"
+
+/*
+ * Interval Block-Max MaxScore: the block boundaries of all the query's lists cut the docs into intervals, within
+ * which every list is bounded by a single block. The intervals' bounds are summed in one merge over the blocks,
+ * then each interval above the threshold is processed as in LBMM (see terms2docs.lbmm.hpp), on those blocks.
+ */
+
+template <>
+uint32_t QueryProgram<IntervalBMMAlgorithm>::query2terms(const Query &query)
+{
+    /* Cleanup from previous query. */
+    while (not pq.empty()) pq.pop();
+
+    lbmw_terms.clear();
+    essentials.clear();
+    nonessentials.clear();
+    intervals.clear();
+    bounds.clear();
+
+    /* Remove UNKs. */
+    qterms.resize(query.terms.size());
+    std::iota(qterms.begin(), qterms.end(), 0);
+
+    auto is_unk = [&](auto idx) { return query.terms[idx] == Collection::UNK; };
+    qterms.erase(std::remove_if(qterms.begin(), qterms.end(), is_unk), qterms.end());
+
+    /*  */
+    uint32_t next_doc = UINT32_MAX;
+
+    std::sort(qterms.begin(), qterms.end(), [&](const auto &a, const auto &b) {
+        return A.terms[query.terms[a]].local_df > A.terms[query.terms[b]].local_df;
+    });
+
+    DocIDsReader doc_ids_reader{A.doc_ids};
+
+    for (auto i : qterms)
+    {
+        uint32_t idx = query.terms[i];
+
+        assert(A.terms[idx].local_df >= 1);
+
+        auto term_stats = UserTermStats(A.collection_stats, A.user_term_stats[idx]);
+
+        lbmw_terms.push_back({idx, i, open_list(doc_ids_reader, idx), term_stats,
+                              A.maxscores[idx], A.bmw_qmaxscores[idx], A.bmw_wdoc[idx],
+                              A.terms[idx].local_df, first_block(idx), uint32_t(-1), Score(), Score(), Message(),
+                              QuantizedBounds::scale(A.maxscores[idx])});
+
+        next_doc = std::min(next_doc, uint32_t(lbmw_terms.back().reader.docid()));
+    }
+
+    return next_doc;
+}
+
+template <>
+void QueryProgram<IntervalBMMAlgorithm>::terms2docs(const Query &query, bool reset_threshold)
+{
+    const uint32_t max_doc = doc_end;
+
+    if (reset_threshold) threshold = model.threshold(query.terms.size());
+    query2terms(query);
+
+    if (lbmw_terms.empty()) return;
+
+    global_doc_maxscore = model.self_receive(query.user_terms, A.global_doc_bound);
+
+    /* Merge the lists' block ends into intervals [begin, end], summing the bounds of the blocks holding each. */
+    for (uint32_t begin = doc_begin; begin < max_doc;)
+    {
+        uint32_t end   = max_doc - 1;
+        auto     bound = global_doc_maxscore;
+
+        for (auto &t : lbmw_terms)
+        {
+            end = std::min(end, t.wdoc[t.widx]);
+            bound += t.block_bound(t.widx);
+        }
+
+        for (auto &t : lbmw_terms)
+            if (t.wdoc[t.widx] == end) t.widx++;
+
+        intervals.push_back({begin, end + 1});
+        bounds.push_back(bound);
+
+        begin = end + 1;
+    }
+
+    for (auto &t : lbmw_terms) t.widx = first_block(t.idx);
+
+    doc_maxscore = global_doc_maxscore;
+
+    for (uint32_t j = 0; j < intervals.size(); j++)
+    {
+        /* The threshold may have risen since the bounds were summed. */
+        if (bounds[j] <= threshold) continue;
+
+        uint32_t offset = intervals[j].first;
+        uint32_t endpos = intervals[j].second;
+
+        for (auto &t : lbmw_terms)
+        {
+            t.ub       = t.local_bound(offset, endpos);
+            t.ub_range = j;
+        }
+
+        process_range(query, offset >> SHARD_RADIX, offset, endpos);
+    }
+}
@@ -0,0 +1,162 @@
+#include "qprogram/query.h"
+
+/*
+ * Local Block-Max MaxScore: MaxScore one doc range at a time, over the blocks of postings of optimize_model().
+ * Within a range, each list is bounded by the max bound of its blocks overlapping the range, and the lists are
+ * split into essential and non-essential ones on those bounds. A range whose bounds sum to the threshold or less
+ * is skipped without moving any list.
+ */
+
+template <>
+uint32_t QueryProgram<LocalBMMAlgorithm>::query2terms(const Query &query)
+{
+    /* Cleanup from previous query. */
+    while (not pq.empty()) pq.pop();
+
+    lbmw_terms.clear();
+    essentials.clear();
+    nonessentials.clear();
+
+    /* Remove UNKs. */
+    qterms.resize(query.terms.size());
+    std::iota(qterms.begin(), qterms.end(), 0);
+
+    auto is_unk = [&](auto idx) { return query.terms[idx] == Collection::UNK; };
+    qterms.erase(std::remove_if(qterms.begin(), qterms.end(), is_unk), qterms.end());
+
+    /*  */
+    uint32_t next_doc = UINT32_MAX;
+
+    std::sort(qterms.begin(), qterms.end(), [&](const auto &a, const auto &b) {
+        return A.terms[query.terms[a]].local_df > A.terms[query.terms[b]].local_df;
+    });
+
+    DocIDsReader doc_ids_reader{A.doc_ids};
+
+    for (auto i : qterms)
+    {
+        uint32_t idx = query.terms[i];
+
+        assert(A.terms[idx].local_df >= 1);
+
+        auto term_stats = UserTermStats(A.collection_stats, A.user_term_stats[idx]);
+
+        lbmw_terms.push_back({idx, i, open_list(doc_ids_reader, idx), term_stats,
+                              A.maxscores[idx], A.bmw_qmaxscores[idx], A.bmw_wdoc[idx],
+                              A.terms[idx].local_df, first_block(idx), uint32_t(-1), Score(), Score(), Message(),
+                              QuantizedBounds::scale(A.maxscores[idx])});
+
+        next_doc = std::min(next_doc, uint32_t(lbmw_terms.back().reader.docid()));
+    }
+
+    return next_doc;
+}
+
+template <>
+void QueryProgram<LocalBMMAlgorithm>::terms2docs(const Query &query, bool reset_threshold)
+{
+    const uint32_t max_doc   = doc_end;
+    const uint32_t max_range = 1 + (max_doc >> SHARD_RADIX);
+
+    if (reset_threshold) threshold = model.threshold(query.terms.size());
+    query2terms(query);
+
+    for (uint32_t range = doc_begin >> SHARD_RADIX; range < max_range; range++)
+    {
+        uint32_t offset = range << SHARD_RADIX;
+        uint32_t endpos = std::min(max_doc, offset + SHARD_NDOCS);
+        if (offset >= endpos) break;
+
+        doc_maxscore = model.self_receive(query.user_terms, A.doc_bounds[range]);
+
+        auto ubsum = doc_maxscore;
+        for (auto &t : lbmw_terms)
+        {
+            t.ub       = t.local_bound(offset, endpos);
+            t.ub_range = range;
+            ubsum += t.ub;
+        }
+
+        if (ubsum > threshold) process_range(query, range, offset, endpos);
+    }
+}
+
+/* MaxScore over docs [offset, endpos), with each of lbmw_terms bounded by its ub there and the docs by
+ * doc_maxscore. Shared by LBMM and IBMM (see terms2docs.ibmm.hpp); LazyMaxScore has its own. */
+template <class Algorithm>
+void QueryProgram<Algorithm>::process_range(const Query &query, uint32_t range, uint32_t offset, uint32_t endpos)
+{
+    essentials.clear();
+    nonessentials.clear();
+    ub_pfxsum1.clear();
+
+    uint32_t next_doc = UINT32_MAX;
+
+    auto ubsum = Score();
+    ub_pfxsum1.push_back(ubsum);
+    for (uint32_t i = 0; i < lbmw_terms.size(); i++)
+    {
+        auto &t = lbmw_terms[i];
+
+        auto ubsum_ = ubsum + t.ub;
+
+        if (t.ub < 0.0000001) continue;
+
+        if (doc_maxscore + ubsum_ <= threshold)
+        {
+            ubsum = ubsum_;
+            ub_pfxsum1.push_back(ubsum);
+            nonessentials.push_back(i);
+        }
+        else
+        {
+            essentials.push_back(i);
+
+            if (t.reader.docid() < offset) t.reader.next_geq(offset);
+
+            next_doc = std::min(next_doc, uint32_t(t.reader.docid()));
+        }
+    }
+
+    while (next_doc < endpos) next_doc = process_doc(query, range, next_doc);
+}
+
+template <class Algorithm>
+uint32_t QueryProgram<Algorithm>::process_doc(const Query &query, uint32_t range, uint32_t doc)
+{
+    // doc_evals++;
+    auto score = model.self_receive(query.user_terms, A.doc_messages[doc]);
+
+    uint32_t next_doc     = UINT32_MAX;
+    int      nonessential = nonessentials.size();
+
+    for (auto i : essentials)
+    {
+        auto &t      = lbmw_terms[i];
+        auto &reader = t.reader;
+
+        if (reader.docid() == doc)
+        {
+            score += model.send(t.idf, reader.freq(), A.doc_stats[doc]);
+            reader.next();
+        }
+
+        next_doc = std::min(next_doc, uint32_t(reader.docid()));
+    }
+
+    for (int i = nonessential - 1; i >= 0; i--)
+    {
+        if (score + ub_pfxsum1[i + 1] <= threshold) return next_doc;
+
+        auto &t      = lbmw_terms[nonessentials[i]];
+        auto &reader = t.reader;
+
+        if (reader.docid() < doc) reader.next_geq(doc);
+
+        if (reader.docid() == doc) score += model.send(t.idf, reader.freq(), A.doc_stats[doc]);
+    }
+
+    topk_insert(doc, score);
+
+    return next_doc;
+}
@@ -1,6 +1,7 @@
 #include "qprogram/query.h"
 
-uint32_t QueryProgram::query2terms(const Query &query)
+template <>
+uint32_t QueryProgram<MaxScoreAlgorithm>::query2terms(const Query &query)
 {
     /* Cleanup from previous query. */
     while (not pq.empty()) pq.pop();
@@ -37,8 +38,13 @@ uint32_t QueryProgram::query2terms(const Query &query)
         // maxscore_terms.push_back(
         //     {idx, i, A.coll[idx], term_stats, A.maxscores[idx], uint32_t(-1), Score(), A.terms[idx].local_df});
 
-        maxscore_terms.push_back({idx, i, EFWrapper(doc_ids_reader, idx, A.terms[idx].local_df, A.terms[idx].local_cf),
-                                  term_stats, A.maxscores[idx], uint32_t(-1), Score(), A.terms[idx].local_df});
+        maxscore_terms.push_back({idx, i, open_list(doc_ids_reader, idx), term_stats,
+                                  A.maxscores[idx], uint32_t(-1), Score(), A.terms[idx].local_df, 0.0f,
+                                  {}, {}, {}});
+
+#if VBMW_BLOCKS
+        maxscore_terms.back().block_cursor = block_bound_cursor(A, idx);
+#endif
 
         next_doc = std::min(next_doc, uint32_t(maxscore_terms.back().reader.docid()));
     }
@@ -46,9 +52,10 @@ uint32_t QueryProgram::query2terms(const Query &query)
     return next_doc;
 }
 
-void QueryProgram::terms2docs(const Query &query, bool reset_threshold)
+template <>
+void QueryProgram<MaxScoreAlgorithm>::terms2docs(const Query &query, bool reset_threshold)
 {
-    const uint32_t max_doc = A.rank_ndocs;
+    const uint32_t max_doc = doc_end;
 
     if (reset_threshold) threshold = model.threshold(query.terms.size());
     uint32_t next_doc              = query2terms(query);
@@ -87,6 +94,20 @@ void QueryProgram::terms2docs(const Query &query, bool reset_threshold)
             next_doc = std::min(next_doc, uint32_t(reader.docid()));
         }
 
+#if VBMW_BLOCKS
+        /* Block-max check: the non-essential lists' blocks at doc, before moving any of their readers. */
+        auto block_ub = score;
+
+        for (uint32_t i = 0; i < optionals; i++)
+        {
+            auto &c = maxscore_terms[i].block_cursor;
+            c.advance(doc);
+            block_ub += c.bound();
+        }
+
+        if (block_ub <= threshold) continue;
+#endif
+
         for (int i = int(optionals) - 1; i >= 0; i--)
         {
             if (score + ub_pfxsum[i + 1] <= threshold) break;
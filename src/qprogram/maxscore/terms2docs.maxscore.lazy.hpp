@@ -1,6 +1,21 @@
+#include "qprogram/maxscore/range_bounds.h"
 #include "qprogram/query.h"
 
-uint32_t QueryProgram::query2terms(const Query &query)
+/* Bound the ranges term-at-a-time (see range_bounds.h), descending the pyramid of range bounds (see optimizer.h). */
+#define TAAT_RANGE_BOUNDS true
+
+/* Specialized below, after their callers. */
+template <>
+void QueryProgram<LazyMaxScoreAlgorithm>::bound_ranges(const Query &query, uint32_t level, uint32_t begin,
+                                                       uint32_t n);
+template <>
+inline void QueryProgram<LazyMaxScoreAlgorithm>::process_range(const Query &query, uint32_t range, uint32_t offset,
+                                                               uint32_t endpos);
+template <>
+inline uint32_t QueryProgram<LazyMaxScoreAlgorithm>::process_doc(const Query &query, uint32_t range, uint32_t doc);
+
+template <>
+uint32_t QueryProgram<LazyMaxScoreAlgorithm>::query2terms(const Query &query)
 {
     /* Cleanup from previous query. */
     while (not pq.empty()) pq.pop();
@@ -33,10 +48,20 @@ uint32_t QueryProgram::query2terms(const Query &query)
         assert(A.terms[idx].local_df >= 1);
 
         auto term_stats = UserTermStats(A.collection_stats, A.user_term_stats[idx]);
+        auto z          = QuantizedBounds::scale(A.maxscores[idx]);
 
-        maxscore_terms.push_back({idx, i, EFWrapper(doc_ids_reader, idx, A.terms[idx].local_df, A.terms[idx].local_cf),
-                                  term_stats, A.maxscores[idx], uint32_t(-1), Score(), A.terms[idx].local_df,
-                                  A.maxscores[idx] / 255.0f});
+        maxscore_terms.push_back({idx, i, open_list(doc_ids_reader, idx), term_stats,
+                                  A.maxscores[idx], uint32_t(-1), Score(), A.terms[idx].local_df, z, {}, {}, {}});
+
+        auto &t = maxscore_terms.back();
+
+#if VBMW_BLOCKS
+        t.block_cursor = block_bound_cursor(A, idx);
+        for (auto &c : t.level_cursors) c = t.block_cursor;
+#else
+        if (t.local_df < SparseRangeBounds::MaxDF)
+            for (auto &c : t.range_cursors) c = A.sparse_bounds.cursor(idx, z);
+#endif
 
         next_doc = std::min(next_doc, uint32_t(maxscore_terms.back().reader.docid()));
     }
@@ -44,9 +69,10 @@ uint32_t QueryProgram::query2terms(const Query &query)
     return next_doc;
 }
 
-void QueryProgram::terms2docs(const Query &query, bool reset_threshold)
+template <>
+void QueryProgram<LazyMaxScoreAlgorithm>::terms2docs(const Query &query, bool reset_threshold)
 {
-    const uint32_t max_doc = A.rank_ndocs;
+    const uint32_t max_doc = doc_end;
 
     if (reset_threshold) threshold = model.threshold(query.terms.size());
     uint32_t next_doc              = query2terms(query);
@@ -55,42 +81,20 @@ void QueryProgram::terms2docs(const Query &query, bool reset_threshold)
     global_doc_maxscore = model.self_receive(query.user_terms, A.global_doc_bound);
     ub_pfxsum.push_back(Score());
 
-    DocIDsReader doc_ids_reader{A.doc_ids};
-
-    for (auto &t : maxscore_terms)
-    {
-        ub_pfxsum.push_back(ub_pfxsum.back() + t.maxscore);
-
-        if (true)
-        {
-            if (t.local_df < (1 << 15))
-            {
-                t.maxscore = Message();
-                auto reader = EFWrapper(doc_ids_reader, t.idx, A.terms[t.idx].local_df, A.terms[t.idx].local_cf);
-                // auto reader = A.coll[t.idx];
-                A.bmw_maxscores[t.idx].clear();
-                A.bmw_maxscores[t.idx].resize(2 + (max_doc >> SHARD_RADIX));
-
-                while (reader.docid() < A.rank_ndocs)
-                {
-                    uint32_t shard = reader.docid() >> SHARD_RADIX;
-
-                    auto msg                      = model.send(t.idf, reader.freq(), A.doc_stats[reader.docid()]);
-                    A.bmw_maxscores[t.idx][shard] = std::max(A.bmw_maxscores[t.idx][shard], msg);
-                    t.maxscore                    = std::max(t.maxscore, msg);
-                    reader.next();
-
-                    // next_calls++;
-                    // send_calls++;
-                }
-            }
-        }
-    }
+    for (auto &t : maxscore_terms) ub_pfxsum.push_back(ub_pfxsum.back() + t.maxscore);
 
     uint32_t optionals = 0;
-    uint32_t max_range = 1 + (max_doc >> SHARD_RADIX);
+    uint32_t max_range = ((max_doc - 1) >> SHARD_RADIX) + 1;
 
-    for (uint32_t range = 0; range < max_range; range++)
+#if TAAT_RANGE_BOUNDS
+    static_assert(std::is_same<Score, float>::value, "Range bounds are accumulated as floats");
+
+    /* The top-level groups overlapping the docs: those of a ParallelProgram worker's window start at doc_begin. */
+    uint32_t first = doc_begin >> (SHARD_RADIX + PYRAMID_RADIX * PYRAMID_LEVELS);
+    uint32_t top   = ((max_range - 1) >> (PYRAMID_RADIX * PYRAMID_LEVELS)) + 1;
+    bound_ranges(query, PYRAMID_LEVELS, first, top - first);
+#else
+    for (uint32_t range = doc_begin >> SHARD_RADIX; range < max_range; range++)
     {
         auto ubsum = model.self_receive(query.user_terms, A.doc_bounds[range]);
 
@@ -122,10 +126,89 @@ void QueryProgram::terms2docs(const Query &query, bool reset_threshold)
             }
         }
     }
+#endif
 }
 
-__attribute__((__always_inline__)) inline void QueryProgram::process_range(const Query &query, uint32_t range,
-                                                                           uint32_t offset, uint32_t endpos)
+/* Bounds ranges [begin, begin + n) of the given pyramid level (0 being the ranges themselves), then processes
+ * the ranges, or descends into the groups, whose bound is above the threshold. */
+template <>
+void QueryProgram<LazyMaxScoreAlgorithm>::bound_ranges(const Query &query, uint32_t level, uint32_t begin,
+                                                       uint32_t n)
+{
+    const uint32_t max_doc   = doc_end;
+    const uint32_t max_range = ((max_doc - 1) >> SHARD_RADIX) + 1;
+
+    auto &ubs        = range_ubs[level];
+    auto &candidates = candidate_ranges[level];
+
+    ubs.resize(n);
+
+    auto &doc_bounds = level ? A.pyramid_doc_bounds[level - 1] : A.doc_bounds;
+    for (uint32_t j = 0; j < n; j++) ubs[j] = model.self_receive(query.user_terms, doc_bounds[begin + j]);
+
+#if VBMW_BLOCKS
+    /* A group of this level spans 1 << radix docs, bounded by the blocks it overlaps. */
+    uint32_t radix = SHARD_RADIX + PYRAMID_RADIX * level;
+
+    for (auto &t : maxscore_terms)
+    {
+        auto &c = t.level_cursors[level];
+
+        for (uint32_t j = 0; j < n; j++)
+        {
+            uint32_t offset = (begin + j) << radix;
+            ubs[j] += c.max_bound(offset, std::min(max_doc, offset + (1u << radix)));
+        }
+    }
+#else
+    for (auto &t : maxscore_terms)
+    {
+        if (t.local_df < SparseRangeBounds::MaxDF)
+        {
+            /* Only the ranges the term occurs in (short lists have no pyramid rows); each level is bounded in
+             * ascending order, so has a cursor of its own. */
+            t.range_cursors[level].add_group_bounds(ubs.data(), begin, begin + n, PYRAMID_RADIX * level);
+        }
+        else if (level == 0)
+        {
+            uint32_t shift = block_bound_shift(A, t.idx);
+            RangeBounds::add_quantized(ubs.data(), A.qmaxscores[t.idx], begin, shift, t.z, n);
+        }
+        else
+        {
+            RangeBounds::add(ubs.data(), A.pyramid_maxscores[level - 1][t.idx] + begin, n);
+        }
+    }
+#endif
+
+    candidates.clear();
+    RangeBounds::candidates(ubs.data(), n, threshold, begin, candidates);
+
+    /* The ranges below a group are those of the level below it. */
+    uint32_t nbelow = level ? ((max_range - 1) >> (PYRAMID_RADIX * (level - 1))) + 1 : 0;
+
+    for (auto range : candidates)
+    {
+        /* The threshold may have risen since the candidates were picked. */
+        if (not(ubs[range - begin] > threshold)) continue;
+
+        if (level)
+        {
+            uint32_t child = range << PYRAMID_RADIX;
+            bound_ranges(query, level - 1, child, std::min(uint32_t(1) << PYRAMID_RADIX, nbelow - child));
+            continue;
+        }
+
+        uint32_t offset = range << SHARD_RADIX;
+        uint32_t endpos = std::min(max_doc, offset + SHARD_NDOCS);
+
+        process_range(query, range, offset, endpos);
+    }
+}
+
+template <>
+__attribute__((__always_inline__)) inline void QueryProgram<LazyMaxScoreAlgorithm>::process_range(
+    const Query &query, uint32_t range, uint32_t offset, uint32_t endpos)
 {
     doc_maxscore = model.self_receive(query.user_terms, A.doc_bounds[range]);
 
@@ -141,7 +224,11 @@ __attribute__((__always_inline__)) inline void QueryProgram::process_range(const
     {
         auto &t = maxscore_terms[i];
 
+#if VBMW_BLOCKS
+        t.block_maxscore = t.block_cursor.max_bound(offset, endpos);
+#else
         t.block_maxscore = get_block_bound(A, t.idx, t.z, t.local_df, range);
+#endif
 
         auto ubsum_ = ubsum + t.block_maxscore;
 
@@ -172,8 +259,9 @@ __attribute__((__always_inline__)) inline void QueryProgram::process_range(const
 
 #define BE_LAZY true
 
-__attribute__((__always_inline__)) inline uint32_t QueryProgram::process_doc(const Query &query, uint32_t range,
-                                                                             uint32_t doc)
+template <>
+__attribute__((__always_inline__)) inline uint32_t QueryProgram<LazyMaxScoreAlgorithm>::process_doc(
+    const Query &query, uint32_t range, uint32_t doc)
 {
     auto score = model.self_receive(query.user_terms, A.doc_messages[doc]);
     // pivot_selections++;
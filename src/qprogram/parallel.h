@@ -0,0 +1,91 @@
+#pragma once
+
+#include <omp.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "qprogram/qprogram.h"
+#include "qprogram/query.h"
+
+/*
+ * Intra-query parallelism: the rank's docs are cut into windows of whole top-level pyramid groups (and so of doc
+ * ranges), which a team of threads takes in turn. Each thread runs the named program on its own instance, i.e.,
+ * with its own lists' cursors and top-k heap, over one window at a time. The threads raise each other's threshold
+ * through a shared atomic (see share_threshold), and their results are merged into one top-k at the end.
+ */
+class ParallelProgram : public QueryProgramBase
+{
+   public:
+    /* Windows per thread, for the threads that finish early to take over some of the others' docs. */
+    static constexpr uint32_t WindowsPerThread = 4;
+
+    ParallelProgram(Collection &C, const std::string &name, uint32_t nthreads) : QueryProgramBase(C)
+    {
+#if TRACE_NEXT_GEQ
+        LOG.info("TRACE_NEXT_GEQ traces into one vector, so queries run on a single thread\n");
+        nthreads = 1;
+#endif
+
+        for (uint32_t i = 0; i < nthreads; i++)
+        {
+            workers.push_back(make_query_program(name, C));
+            workers.back()->shared_threshold = &shared;
+        }
+
+        results.resize(nthreads);
+
+        uint32_t group   = SHARD_NDOCS << (PYRAMID_RADIX * PYRAMID_LEVELS);
+        uint32_t ngroups = (A.rank_ndocs - 1) / group + 1;
+        uint32_t nwins   = std::min(ngroups, WindowsPerThread * nthreads);
+
+        window = ((ngroups - 1) / nwins + 1) * group;
+    }
+
+    void terms2docs(const Query &query, bool reset_threshold) override
+    {
+        if (reset_threshold) threshold = model.threshold(query.terms.size());
+
+        const Score    initial_threshold = threshold;
+        const uint32_t nwindows          = (A.rank_ndocs - 1) / window + 1;
+
+        shared.store(threshold, std::memory_order_relaxed);
+        std::atomic<uint32_t> next_window{0};
+
+#pragma omp parallel num_threads(workers.size())
+        {
+            uint32_t thread = omp_get_thread_num();
+            auto &   worker = *workers[thread];
+
+            results[thread].clear();
+            worker.local_TopK = local_TopK;
+            worker.TopK       = TopK;
+
+            for (uint32_t w; (w = next_window.fetch_add(1, std::memory_order_relaxed)) < nwindows;)
+            {
+                worker.doc_begin = w * window;
+                worker.doc_end   = std::min(A.rank_ndocs, worker.doc_begin + window);
+                worker.threshold = shared.load(std::memory_order_relaxed);
+
+                worker.terms2docs(query, false);
+
+                for (; not worker.pq.empty(); worker.pq.pop()) results[thread].push_back(worker.pq.top());
+            }
+        }
+
+        for (auto &worker : workers) take_counters(*worker);
+
+        /* Every doc of the top-k was above the shared threshold when scored, and so is in some window's heap. */
+        while (not pq.empty()) pq.pop();
+        threshold = initial_threshold;
+
+        for (auto &docs : results)
+            for (auto &d : docs) topk_insert(d.doc, d.score);
+    }
+
+   private:
+    std::vector<std::unique_ptr<QueryProgramBase>> workers;
+    std::vector<std::vector<DocScore>>             results;
+    std::atomic<Score>                             shared;
+    uint32_t                                       window;
+};
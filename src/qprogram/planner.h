@@ -0,0 +1,245 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "qprogram/qprogram.h"
+#include "qprogram/query.h"
+
+/*
+ * The "Adaptive" program: runs each query with whichever program of QueryPrograms is predicted to be fastest
+ * on it. The prediction is a linear model of the log latency over cheap features of the query (its number of
+ * terms, the sum and max of their dfs, the spread of their term bounds, and k), fit per program by replaying
+ * the first queries of the log through every program before serving.
+ */
+class AdaptiveProgram : public QueryProgramBase
+{
+   public:
+    static constexpr uint32_t NumFeatures  = 6;
+    static constexpr uint32_t TrainQueries = 200;
+    static constexpr double   Ridge        = 0.01; /* Keeps the fit well-posed when a feature barely varies. */
+
+    using Features = std::array<double, NumFeatures>;
+
+    AdaptiveProgram(Collection &C, const std::string &queries_path, uint32_t nqueries) : QueryProgramBase(C)
+    {
+        make_programs();
+
+        auto fitted = std::make_shared<std::vector<Features>>(programs.size());
+        weights     = fitted;
+
+        calibrate(queries_path, std::min(nqueries, TrainQueries), *fitted);
+    }
+
+    /* Another instance (e.g., for another thread of QueryServer), with programs of its own but this cost model. */
+    std::unique_ptr<QueryProgramBase> replicate() const
+    {
+        return std::unique_ptr<QueryProgramBase>(new AdaptiveProgram(C, weights));
+    }
+
+    void terms2docs(const Query &query, bool reset_threshold) override
+    {
+        uint32_t p = choose(query, TopK);
+        choices[p]++;
+
+        auto &program      = *programs[p];
+        program.local_TopK = local_TopK;
+        program.TopK       = TopK;
+        if (not reset_threshold) program.threshold = threshold;
+
+        program.terms2docs(query, reset_threshold);
+
+        /* The results are read from here (see distributed_topk); the program clears its own at the next query. */
+        std::swap(pq, program.pq);
+        threshold = program.threshold;
+
+        take_counters(program);
+    }
+
+    /* How many queries each program has run (since calibration). */
+    void log_choices() const
+    {
+        LOG.info("Adaptive program choices:");
+        for (uint32_t p = 0; p < programs.size(); p++) LOG.info<false, false>(" %s=%lu", names[p], choices[p]);
+        LOG.info<false, false>("\n");
+    }
+
+   private:
+    AdaptiveProgram(Collection &C, std::shared_ptr<const std::vector<Features>> weights)
+        : QueryProgramBase(C), weights(weights)
+    {
+        make_programs();
+    }
+
+    void make_programs()
+    {
+        for (auto &entry : QueryPrograms)
+        {
+            names.push_back(entry.name);
+            programs.push_back(entry.make(C));
+        }
+
+        choices.resize(programs.size());
+    }
+
+    Features features(const Query &query, uint32_t k) const
+    {
+        double   sum_df = 0, max_df = 0, sum_bound = 0, max_bound = 0;
+        uint32_t nterms = 0;
+
+        for (auto idx : query.terms)
+        {
+            if (idx == Collection::UNK) continue;
+
+            nterms++;
+            sum_df += A.terms[idx].local_df;
+            max_df = std::max(max_df, double(A.terms[idx].local_df));
+            sum_bound += A.maxscores[idx];
+            max_bound = std::max(max_bound, double(A.maxscores[idx]));
+        }
+
+        double spread = sum_bound > 0 ? 1.0 - max_bound / sum_bound : 0.0;
+
+        return {1.0, double(nterms), std::log2(1 + sum_df), std::log2(1 + max_df), spread, std::log2(double(k))};
+    }
+
+    uint32_t choose(const Query &query, uint32_t k) const
+    {
+        auto f = features(query, k);
+
+        uint32_t best      = 0;
+        double   best_cost = INFINITY;
+
+        for (uint32_t p = 0; p < programs.size(); p++)
+        {
+            double cost = 0;
+            for (uint32_t j = 0; j < NumFeatures; j++) cost += (*weights)[p][j] * f[j];
+
+            if (cost < best_cost)
+            {
+                best      = p;
+                best_cost = cost;
+            }
+        }
+
+        return best;
+    }
+
+    /* Times every program on the first ntrain queries, at the k's of main(), and fits each one's weights. */
+    void calibrate(const std::string &queries_path, uint32_t ntrain, std::vector<Features> &fitted)
+    {
+        std::vector<Query> queries;
+
+        std::ifstream queries_file(queries_path);
+        std::string   text, term;
+
+        for (auto q = 0u; q < ntrain and std::getline(queries_file, text); q++)
+        {
+            /* Not Query::from_text(), which would draw from rand() ahead of main()'s queries. */
+            queries.emplace_back(C);
+
+            std::istringstream iss(text);
+            while (iss >> term)
+            {
+                queries.back().user_terms.emplace_back(term);
+                queries.back().terms.push_back(C.term_label2idx(term));
+            }
+        }
+
+        std::vector<Features>            samples;
+        std::vector<std::vector<double>> log_times(programs.size());
+        std::vector<double>              total_ms(programs.size());
+
+        /* Program by program within each query, after an untimed run that faults in and caches its lists (as they
+         * would be for the other programs), and from a different program each time, so no program comes first. */
+        for (uint32_t q = 0; q < queries.size(); q++)
+        {
+            auto &query = queries[q];
+
+            programs[q % programs.size()]->terms2docs(query, true);
+
+            for (uint32_t k : {10u, 1000u})
+            {
+                samples.push_back(features(query, k));
+
+                for (uint32_t i = 0; i < programs.size(); i++)
+                {
+                    uint32_t p         = (q + i) % programs.size();
+                    auto &   program   = *programs[p];
+                    program.local_TopK = program.TopK = k;
+
+                    double t = Env::now();
+                    program.terms2docs(query, true);
+                    t = (Env::now() - t) * 1000.0;
+
+                    total_ms[p] += t;
+                    log_times[p].push_back(std::log2(t + 0.001));
+                }
+            }
+        }
+
+        for (uint32_t p = 0; p < programs.size(); p++)
+        {
+            fitted[p] = fit(samples, log_times[p]);
+            take_counters(*programs[p]); /* main() zeroes them before its queries. */
+        }
+
+        /* What the model would pick on the queries it was fit on. */
+        std::vector<size_t> picks(programs.size());
+        for (auto &query : queries)
+            for (uint32_t k : {10u, 1000u}) picks[choose(query, k)]++;
+
+        LOG.info("Calibrated the adaptive program on %lu queries:", queries.size());
+        for (uint32_t p = 0; p < programs.size(); p++)
+            LOG.info<false, false>(" %s=%.1fms(%lu)", names[p], total_ms[p], picks[p]);
+        LOG.info<false, false>("\n");
+    }
+
+    /* Ridge least squares of y over the samples, by Gaussian elimination of the normal equations. */
+    static Features fit(const std::vector<Features> &samples, const std::vector<double> &y)
+    {
+        double M[NumFeatures][NumFeatures + 1] = {};
+
+        for (size_t s = 0; s < samples.size(); s++)
+        {
+            for (uint32_t i = 0; i < NumFeatures; i++)
+            {
+                for (uint32_t j = 0; j < NumFeatures; j++) M[i][j] += samples[s][i] * samples[s][j];
+                M[i][NumFeatures] += samples[s][i] * y[s];
+            }
+        }
+
+        for (uint32_t i = 0; i < NumFeatures; i++) M[i][i] += Ridge * (1 + samples.size());
+
+        for (uint32_t c = 0; c < NumFeatures; c++)
+        {
+            uint32_t pivot = c;
+            for (uint32_t r = c + 1; r < NumFeatures; r++)
+                if (std::abs(M[r][c]) > std::abs(M[pivot][c])) pivot = r;
+
+            for (uint32_t j = 0; j <= NumFeatures; j++) std::swap(M[c][j], M[pivot][j]);
+
+            for (uint32_t r = 0; r < NumFeatures; r++)
+            {
+                if (r == c or M[c][c] == 0) continue;
+
+                double factor = M[r][c] / M[c][c];
+                for (uint32_t j = c; j <= NumFeatures; j++) M[r][j] -= factor * M[c][j];
+            }
+        }
+
+        Features w;
+        for (uint32_t i = 0; i < NumFeatures; i++) w[i] = M[i][i] != 0 ? M[i][NumFeatures] / M[i][i] : 0.0;
+
+        return w;
+    }
+
+    std::vector<const char *>                      names;
+    std::vector<std::unique_ptr<QueryProgramBase>> programs;
+    std::shared_ptr<const std::vector<Features>>   weights; /* Read-only once calibrated: shared by replicas. */
+    std::vector<size_t>                            choices;
+};
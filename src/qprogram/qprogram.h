@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <queue>
 #include <string>
 #include <unordered_map>
@@ -8,7 +10,11 @@
 #include "utils/common.h"
 #include "utils/dist_timer.h"
 
-class QueryProgram
+/*
+ * The state of a query program, shared by all algorithms: main() holds a program through this class, and picks
+ * the algorithm at run time (see make_query_program below).
+ */
+class QueryProgramBase
 {
    public:
     constexpr static uint32_t MaxQueryNumTerms = 256;
@@ -47,10 +53,11 @@ class QueryProgram
         }
     };
 
-    Collection &                   C;
-    Graph<EdgeWeight> &            G;
-    RectangularMatrix<EdgeWeight> &A;
-    ChosenTerm2Doc                 model;
+    /* The index is read-only once loaded and optimized: programs on several threads share it. */
+    Collection &                         C;
+    Graph<EdgeWeight> &                  G;
+    const RectangularMatrix<EdgeWeight> &A;
+    ChosenTerm2Doc                       model;
 
     struct DAAT_Term;
     struct MaxScore_Term;
@@ -58,7 +65,7 @@ class QueryProgram
     struct LocalBMW_Term;
     struct DocScore;
 
-    QueryProgram(Collection &C) : C(C), G(C.G), A(G.A), model(A.collection_stats)
+    QueryProgramBase(Collection &C) : C(C), G(C.G), A(G.A), model(A.collection_stats), doc_end(A.rank_ndocs)
     {
         daat_terms.reserve(MaxQueryNumTerms);
         qterms.reserve(MaxQueryNumTerms);
@@ -74,21 +81,33 @@ class QueryProgram
         all_topk.reserve(TopK * Env::nranks);
     }
 
-    void terms2docs(const Query &, bool);
-    bool distributed_topk(bool);
+    virtual ~QueryProgramBase()
+    {
+    }
 
-    //    private:
-    uint32_t query2terms(const Query &);
+    virtual void terms2docs(const Query &, bool) = 0;
+    bool         distributed_topk(bool);
 
+    //    private:
     bool topk_insert(uint32_t doc, Score score);
-    void process_range(const Query &query, uint32_t range, uint32_t offset, uint32_t endpos);
-    uint32_t process_doc(const Query &query, uint32_t range, uint32_t doc);
-    uint32_t skip_to_next_live_block(const Query &query, uint32_t check_up_to_list, uint32_t optionals,
-                                     uint32_t endpos);
+    void share_threshold();
 
     Score    global_doc_maxscore;
     Score threshold;
 
+    /* The docs terms2docs scores: all of the rank's, but a window of them in a worker of ParallelProgram. */
+    uint32_t doc_begin = 0;
+    uint32_t doc_end;
+
+    /* The workers of a ParallelProgram raise each other's threshold through this (see share_threshold). */
+    std::atomic<Score> *shared_threshold = nullptr;
+
+    /* A new list's reader, moved to doc_begin. */
+    EFWrapper open_list(DocIDsReader &doc_ids_reader, uint32_t idx);
+
+    /* The block of list idx's postings holding doc_begin, where its block cursor starts. */
+    uint32_t first_block(uint32_t idx) const;
+
     std::vector<DAAT_Term>        daat_terms;
 
     std::vector<MaxScore_Term> maxscore_terms;
@@ -116,61 +135,138 @@ class QueryProgram
     size_t topk_insertions  = 0;
     size_t next_calls       = 0;
 
+    /* Moves the profiling counts of a program this one ran queries on (see parallel.h, planner.h) into its own. */
+    void take_counters(QueryProgramBase &from);
+
     uint32_t optionals = 0;
 
     std::vector<std::pair<uint32_t, uint32_t>> final_intervals;
     std::vector<float>              bounds;
     std::vector<std::pair<uint32_t, uint32_t>> intervals;
     std::vector<uint32_t> positions;
+
+    /* LazyMaxScore: per pyramid level, the upper bounds of the ranges being bounded, and those above the threshold. */
+    std::vector<float>    range_ubs[PYRAMID_LEVELS + 1];
+    std::vector<uint32_t> candidate_ranges[PYRAMID_LEVELS + 1];
+};
+
+/* The algorithms, as tags: named apart from the -D<program> macros, which are defined to 1. */
+struct DAATAlgorithm;
+struct MaxScoreAlgorithm;
+struct LazyMaxScoreAlgorithm;
+struct WANDAlgorithm;
+struct BMWAlgorithm;
+struct LocalBMWAlgorithm;
+struct DocRangeBMWAlgorithm;
+struct BMMAlgorithm;
+struct LocalBMMAlgorithm;
+struct IntervalBMMAlgorithm;
+struct DocRangeBMMAlgorithm;
+
+/* A query program for one algorithm: its terms2docs-family file specializes the members that algorithm uses. */
+template <class Algorithm>
+class QueryProgram final : public QueryProgramBase
+{
+   public:
+    QueryProgram(Collection &C) : QueryProgramBase(C)
+    {
+    }
+
+    void terms2docs(const Query &, bool) override;
+
+    uint32_t query2terms(const Query &);
+
+    void     process_range(const Query &query, uint32_t range, uint32_t offset, uint32_t endpos);
+    void     bound_ranges(const Query &query, uint32_t level, uint32_t begin, uint32_t n);
+    uint32_t process_doc(const Query &query, uint32_t range, uint32_t doc);
+    uint32_t skip_to_next_live_block(const Query &query, uint32_t check_up_to_list, uint32_t optionals,
+                                     uint32_t endpos);
 };
 
 /* Implementation. */
 #include "qprogram/activity.hpp"
 
-#ifdef DAAT
 #include "qprogram/terms2docs.full.hpp"
-#endif
-
-#ifdef BMW
+#include "qprogram/maxscore/terms2docs.maxscore.hpp"
+#include "qprogram/wand/terms2docs.wand.hpp"
 #include "qprogram/wand/terms2docs.bmw.hpp"
-#endif
-
-#ifdef LBMW
 #include "qprogram/wand/terms2docs.lbmw.hpp"
-#endif
-
-#ifdef VBMW
-#include "qprogram/wand/terms2docs.bmw.hpp"
-#endif
-
-#ifdef DBMW
-#include "qprogram/wand/terms2docs.dbmw.hpp"
-#endif
-
-#ifdef BMM
 #include "qprogram/maxscore/terms2docs.bmm.hpp"
-#endif
-
-#ifdef LBMM
 #include "qprogram/maxscore/terms2docs.lbmm.hpp"
-#endif
-
-#ifdef IBMM
 #include "qprogram/maxscore/terms2docs.ibmm.hpp"
-#endif
-
-#ifdef DBMM
+#include "qprogram/wand/terms2docs.dbmw.hpp"
 #include "qprogram/maxscore/terms2docs.dbmm.hpp"
-#endif
+#include "qprogram/maxscore/terms2docs.maxscore.lazy.hpp"
 
-#ifdef MaxScore
-#include "qprogram/maxscore/terms2docs.maxscore.hpp"
-#endif
+/* Every program, by name: optimize_model() computes the bounds of both the block-max programs (per block of postings,
+ * or VBMW partition) and the doc-range ones, so any of them runs on the same index and bounds cache. */
+struct QueryProgramEntry
+{
+    const char *name;
+    std::unique_ptr<QueryProgramBase> (*make)(Collection &);
+};
 
-#ifdef WAND
-#include "qprogram/wand/terms2docs.wand.hpp"
+template <class Algorithm>
+std::unique_ptr<QueryProgramBase> make_program(Collection &C)
+{
+    return std::unique_ptr<QueryProgramBase>(new QueryProgram<Algorithm>(C));
+}
+
+const QueryProgramEntry QueryPrograms[] = {
+    {"DAAT", make_program<DAATAlgorithm>},
+    {"MaxScore", make_program<MaxScoreAlgorithm>},
+    {"WAND", make_program<WANDAlgorithm>},
+#if VBMW_BLOCKS
+    {"VBMW", make_program<BMWAlgorithm>},
+#else
+    {"BMW", make_program<BMWAlgorithm>},
 #endif
+    {"LBMW", make_program<LocalBMWAlgorithm>},
+    {"BMM", make_program<BMMAlgorithm>},
+    {"LBMM", make_program<LocalBMMAlgorithm>},
+    {"IBMM", make_program<IntervalBMMAlgorithm>},
+    {"DBMW", make_program<DocRangeBMWAlgorithm>},
+    {"DBMM", make_program<DocRangeBMMAlgorithm>},
+    {"LazyMaxScore", make_program<LazyMaxScoreAlgorithm>},
+};
 
-#ifdef LazyMaxScore
-#include "qprogram/maxscore/terms2docs.maxscore.lazy.hpp"
+/* The program built with -D<program>, if it is in the table. */
+#if defined(LazyMaxScore)
+#define DEFAULT_QUERY_PROGRAM "LazyMaxScore"
+#elif defined(MaxScore)
+#define DEFAULT_QUERY_PROGRAM "MaxScore"
+#elif defined(WAND)
+#define DEFAULT_QUERY_PROGRAM "WAND"
+#elif defined(BMW)
+#define DEFAULT_QUERY_PROGRAM "BMW"
+#elif defined(VBMW)
+#define DEFAULT_QUERY_PROGRAM "VBMW"
+#elif defined(LBMW)
+#define DEFAULT_QUERY_PROGRAM "LBMW"
+#elif defined(DBMW)
+#define DEFAULT_QUERY_PROGRAM "DBMW"
+#elif defined(BMM)
+#define DEFAULT_QUERY_PROGRAM "BMM"
+#elif defined(LBMM)
+#define DEFAULT_QUERY_PROGRAM "LBMM"
+#elif defined(IBMM)
+#define DEFAULT_QUERY_PROGRAM "IBMM"
+#elif defined(DBMM)
+#define DEFAULT_QUERY_PROGRAM "DBMM"
+#else
+#define DEFAULT_QUERY_PROGRAM "DAAT"
 #endif
+
+/* The program of the given name, over C's (already optimized) index; exits if this build has no such program. */
+std::unique_ptr<QueryProgramBase> make_query_program(const std::string &name, Collection &C)
+{
+    for (auto &entry : QueryPrograms)
+        if (name == entry.name) return entry.make(C);
+
+    LOG.info("No query program %s in this build; it has:", name.c_str());
+    for (auto &entry : QueryPrograms) LOG.info<false, false>(" %s", entry.name);
+    LOG.info<false, false>("\n");
+
+    Env::exit(1);
+    return nullptr;
+}
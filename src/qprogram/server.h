@@ -0,0 +1,76 @@
+#pragma once
+
+#include <omp.h>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <numeric>
+#include <vector>
+#include "qprogram/qprogram.h"
+#include "qprogram/query.h"
+
+/*
+ * Inter-query parallelism: serves a batch of queries on a pool of threads, each with a query program of its own.
+ * A program is only the state of the query it runs; the index it reads is shared, and read-only once optimized.
+ */
+class QueryServer
+{
+   public:
+    QueryServer(std::function<std::unique_ptr<QueryProgramBase>()> new_program, uint32_t nworkers)
+    {
+#if TRACE_NEXT_GEQ
+        LOG.info("TRACE_NEXT_GEQ traces into one vector, so queries are served one at a time\n");
+        nworkers = 1;
+#endif
+
+        for (uint32_t i = 0; i < nworkers; i++) workers.push_back(new_program());
+    }
+
+    /* Runs the queries at top-k, as many at once as there are workers, and logs the throughput and latencies.
+     * Returns the checksum of the thresholds, summed in query order as main() does. */
+    float serve(const std::vector<Query> &queries, uint32_t k)
+    {
+        std::vector<double> query_times(queries.size());
+        std::vector<float>  thresholds(queries.size());
+
+        Env::barrier();
+        double t = Env::now();
+
+#pragma omp parallel num_threads(workers.size())
+        {
+            auto &qp = *workers[omp_get_thread_num()];
+
+            qp.local_TopK = qp.TopK = k;
+
+#pragma omp for schedule(dynamic, 1)
+            for (size_t q = 0; q < queries.size(); q++)
+            {
+                double tq = Env::now();
+                qp.terms2docs(queries[q], true);
+                query_times[q] = (Env::now() - tq) * 1000.0;
+
+                thresholds[q] = roundf(qp.threshold * 1000) / 1000;
+
+                /* Per rank: concurrent queries cannot take turns in its collectives. */
+                qp.distributed_topk(false);
+            }
+        }
+
+        t = Env::now() - t;
+        Env::barrier();
+
+        float checksum = std::accumulate(thresholds.begin(), thresholds.end(), 0.0f);
+
+        std::sort(query_times.begin(), query_times.end());
+
+        LOG.info("Top-%u on %lu threads: %.1f queries/s, avg %.3f ms, 50-percentile %.3f ms, 99-percentile %.3f ms\n",
+                 k, workers.size(), queries.size() / t,
+                 std::accumulate(query_times.begin(), query_times.end(), 0.0) / double(queries.size()),
+                 query_times[query_times.size() * 50 / 100], query_times[query_times.size() * 99 / 100]);
+
+        return checksum;
+    }
+
+   private:
+    std::vector<std::unique_ptr<QueryProgramBase>> workers;
+};
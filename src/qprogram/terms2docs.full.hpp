@@ -1,7 +1,8 @@
 #include "qprogram/query.h"
 
 // TODO: Is this relying on undefined behavior? Passing by value what might be destructed?
-uint32_t QueryProgram::query2terms(const Query &query)
+template <>
+uint32_t QueryProgram<DAATAlgorithm>::query2terms(const Query &query)
 {
     /* Cleanup from previous query. */
     while (not pq.empty()) pq.pop();
@@ -33,6 +34,12 @@ uint32_t QueryProgram::query2terms(const Query &query)
 
         auto fiterator = doc_ids_reader.get_freqs(idx, A.terms[idx].local_df, A.terms[idx].local_cf);
 
+        if (doc_begin)
+        {
+            reader.skipTo(doc_begin);
+            fiterator.skipToPosition(reader.position());
+        }
+
         auto term_stats = UserTermStats(A.collection_stats, A.user_term_stats[idx]);
 
         daat_terms.push_back({idx, i, reader, fiterator, term_stats});
@@ -42,9 +49,10 @@ uint32_t QueryProgram::query2terms(const Query &query)
     return next_doc;
 }
 
-void QueryProgram::terms2docs(const Query &query, bool reset_threshold)
+template <>
+void QueryProgram<DAATAlgorithm>::terms2docs(const Query &query, bool reset_threshold)
 {
-    const uint32_t max_doc = A.rank_ndocs;
+    const uint32_t max_doc = doc_end;
 
     if (reset_threshold)
         threshold     = model.threshold(query.terms.size());  // NOTE: This best called before removing the UNKs?
@@ -97,6 +105,7 @@ void QueryProgram::terms2docs(const Query &query, bool reset_threshold)
             pq.push({doc, score});
 
             threshold = (pq.size() == TopK) ? pq.top().score : threshold;
+            if (shared_threshold) share_threshold();
         }
     }
 }
@@ -0,0 +1,141 @@
+#include "qprogram/query.h"
+
+/*
+ * Block-Max WAND, over the blocks of postings of optimize_model() (or VBMW's variable blocks): a pivot found on
+ * the term bounds is only scored if the bounds of the blocks holding it also exceed the threshold. Otherwise the
+ * lists skip past the first of those blocks to end.
+ */
+
+template <>
+uint32_t QueryProgram<BMWAlgorithm>::query2terms(const Query &query)
+{
+    /* Cleanup from previous query. */
+    while (not pq.empty()) pq.pop();
+
+    bmw_terms.clear();
+    ordered_enums.clear();
+
+    /* Remove UNKs. */
+    qterms.resize(query.terms.size());
+    std::iota(qterms.begin(), qterms.end(), 0);
+
+    auto is_unk = [&](auto idx) { return query.terms[idx] == Collection::UNK; };
+    qterms.erase(std::remove_if(qterms.begin(), qterms.end(), is_unk), qterms.end());
+
+    DocIDsReader doc_ids_reader{A.doc_ids};
+
+    for (auto i : qterms)
+    {
+        uint32_t idx = query.terms[i];
+
+        assert(A.terms[idx].local_df >= 1);
+
+        auto term_stats = UserTermStats(A.collection_stats, A.user_term_stats[idx]);
+
+        bmw_terms.push_back({idx, i, open_list(doc_ids_reader, idx), term_stats,
+                             A.maxscores[idx], A.bmw_qmaxscores[idx], A.bmw_wdoc[idx],
+                             A.terms[idx].local_df, first_block(idx), uint32_t(-1), Score(), Score(),
+                             QuantizedBounds::scale(A.maxscores[idx])});
+    }
+
+    /* After the last push_back, which may move the terms. */
+    for (auto &t : bmw_terms) ordered_enums.push_back(&t);
+    sort_by_docid(ordered_enums);
+
+    return ordered_enums.empty() ? UINT32_MAX : ordered_enums[0]->reader.docid();
+}
+
+template <>
+void QueryProgram<BMWAlgorithm>::terms2docs(const Query &query, bool reset_threshold)
+{
+    const uint32_t max_doc = doc_end;
+
+    if (reset_threshold) threshold = model.threshold(query.terms.size());
+    query2terms(query);
+
+    global_doc_maxscore = model.self_receive(query.user_terms, A.global_doc_bound);
+
+    auto &enums = ordered_enums;
+
+    while (true)
+    {
+        /* Pivot selection, on the term bounds. */
+        auto     ub    = global_doc_maxscore;
+        uint32_t pivot = 0;
+
+        for (; pivot < enums.size(); pivot++)
+        {
+            ub += enums[pivot]->maxscore;
+            if (ub > threshold) break;
+        }
+
+        if (pivot == enums.size()) break;
+
+        uint32_t doc = enums[pivot]->reader.docid();
+        if (doc >= max_doc) break;
+
+        /* The lists after the pivot that are also at it. */
+        while (pivot + 1 < enums.size() and enums[pivot + 1]->reader.docid() == doc) pivot++;
+
+        // pivot_selections++;
+
+        /* Shallow check, on the blocks holding doc. */
+        uint32_t range    = doc >> SHARD_RADIX;
+        auto     block_ub = model.self_receive(query.user_terms, A.doc_bounds[range]);
+
+        for (uint32_t i = 0; i <= pivot; i++)
+        {
+            auto &t = *enums[i];
+            t.advance_block(doc);
+            t.block_maxscore = t.block_bound(t.widx);
+            block_ub += t.block_maxscore;
+        }
+
+        if (block_ub > threshold)
+        {
+            if (enums[0]->reader.docid() == doc)
+            {
+                // doc_evals++;
+                auto score = model.self_receive(query.user_terms, A.doc_messages[doc]);
+
+                for (uint32_t i = 0; i <= pivot; i++)
+                {
+                    auto &t = *enums[i];
+
+                    score += model.send(t.idf, t.reader.freq(), A.doc_stats[doc]);
+                    t.reader.next();
+                }
+
+                topk_insert(doc, score);
+                sort_by_docid(enums);
+            }
+            else
+            {
+                /* Move the last list before the pivot up to it. */
+                uint32_t i = pivot;
+                while (enums[i]->reader.docid() == doc) i--;
+
+                enums[i]->reader.next_geq(doc);
+                bubble_down(enums, i);
+            }
+
+            continue;
+        }
+
+        /* No doc up to the end of these blocks (or of doc's range) can make it: skip past the first to end. */
+        uint32_t next = std::min(max_doc, (range + 1) << SHARD_RADIX);
+        uint32_t best = 0;
+
+        for (uint32_t i = 0; i <= pivot; i++)
+        {
+            next = std::min(next, enums[i]->wdoc[enums[i]->widx] + 1);
+            if (enums[i]->maxscore > enums[best]->maxscore) best = i;
+        }
+
+        if (pivot + 1 < enums.size()) next = std::min(next, uint32_t(enums[pivot + 1]->reader.docid()));
+
+        /* Past doc, as the blocks and range hold it. */
+        enums[best]->reader.next_geq(std::max(next, doc + 1));
+        bubble_down(enums, best);
+    }
+}
@@ -0,0 +1,130 @@
+#include "qprogram/query.h"
+
+/*
+ * Local BMW: WAND one doc range at a time, over the blocks of postings of optimize_model(). Within a range, each
+ * list is weighed by the max bound of its blocks overlapping the range, rather than by its term bound. A range
+ * whose local bounds sum to the threshold or less is skipped without moving any list.
+ */
+
+template <>
+uint32_t QueryProgram<LocalBMWAlgorithm>::query2terms(const Query &query)
+{
+    /* Cleanup from previous query. */
+    while (not pq.empty()) pq.pop();
+
+    lbmw_terms.clear();
+    lbmw_enums.clear();
+
+    /* Remove UNKs. */
+    qterms.resize(query.terms.size());
+    std::iota(qterms.begin(), qterms.end(), 0);
+
+    auto is_unk = [&](auto idx) { return query.terms[idx] == Collection::UNK; };
+    qterms.erase(std::remove_if(qterms.begin(), qterms.end(), is_unk), qterms.end());
+
+    uint32_t next_doc = UINT32_MAX;
+
+    DocIDsReader doc_ids_reader{A.doc_ids};
+
+    for (auto i : qterms)
+    {
+        uint32_t idx = query.terms[i];
+
+        assert(A.terms[idx].local_df >= 1);
+
+        auto term_stats = UserTermStats(A.collection_stats, A.user_term_stats[idx]);
+
+        lbmw_terms.push_back({idx, i, open_list(doc_ids_reader, idx), term_stats,
+                              A.maxscores[idx], A.bmw_qmaxscores[idx], A.bmw_wdoc[idx],
+                              A.terms[idx].local_df, first_block(idx), uint32_t(-1), Score(), Score(), Message(),
+                              QuantizedBounds::scale(A.maxscores[idx])});
+
+        next_doc = std::min(next_doc, uint32_t(lbmw_terms.back().reader.docid()));
+    }
+
+    /* After the last push_back, which may move the terms. */
+    for (auto &t : lbmw_terms) lbmw_enums.push_back(&t);
+
+    return next_doc;
+}
+
+template <>
+void QueryProgram<LocalBMWAlgorithm>::terms2docs(const Query &query, bool reset_threshold)
+{
+    const uint32_t max_doc   = doc_end;
+    const uint32_t max_range = 1 + (max_doc >> SHARD_RADIX);
+
+    if (reset_threshold) threshold = model.threshold(query.terms.size());
+    query2terms(query);
+
+    auto &enums = lbmw_enums;
+
+    for (uint32_t range = doc_begin >> SHARD_RADIX; range < max_range; range++)
+    {
+        uint32_t offset = range << SHARD_RADIX;
+        uint32_t endpos = std::min(max_doc, offset + SHARD_NDOCS);
+        if (offset >= endpos) break;
+
+        doc_maxscore = model.self_receive(query.user_terms, A.doc_bounds[range]);
+
+        auto ubsum = doc_maxscore;
+        for (auto &t : lbmw_terms)
+        {
+            t.ub       = t.local_bound(offset, endpos);
+            t.ub_range = range;
+            ubsum += t.ub;
+        }
+
+        if (ubsum <= threshold) continue;
+
+        for (auto t : enums)
+            if (t->reader.docid() < offset) t->reader.next_geq(offset);
+
+        sort_by_docid(enums);
+
+        while (true)
+        {
+            /* Pivot selection, on the local bounds. */
+            auto     ub    = doc_maxscore;
+            uint32_t pivot = 0;
+
+            for (; pivot < enums.size(); pivot++)
+            {
+                ub += enums[pivot]->ub;
+                if (ub > threshold) break;
+            }
+
+            if (pivot == enums.size()) break;
+
+            uint32_t doc = enums[pivot]->reader.docid();
+            if (doc >= endpos) break;
+
+            // pivot_selections++;
+
+            if (enums[0]->reader.docid() == doc)
+            {
+                // doc_evals++;
+                auto score = model.self_receive(query.user_terms, A.doc_messages[doc]);
+
+                for (auto t : enums)
+                {
+                    if (t->reader.docid() != doc) break;
+
+                    score += model.send(t->idf, t->reader.freq(), A.doc_stats[doc]);
+                    t->reader.next();
+                }
+
+                topk_insert(doc, score);
+                sort_by_docid(enums);
+            }
+            else
+            {
+                /* Move the last list before the pivot up to it. */
+                while (enums[pivot]->reader.docid() == doc) pivot--;
+
+                enums[pivot]->reader.next_geq(doc);
+                bubble_down(enums, pivot);
+            }
+        }
+    }
+}
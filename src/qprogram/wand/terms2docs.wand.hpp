@@ -0,0 +1,100 @@
+#include "qprogram/query.h"
+
+/* WAND: the lists are kept in docid order, and a doc is only scored once the term bounds of the lists up to it
+ * (the pivot) exceed the threshold. Needs only the term bounds, so it runs on any layout of the bounds. */
+
+template <>
+uint32_t QueryProgram<WANDAlgorithm>::query2terms(const Query &query)
+{
+    /* Cleanup from previous query. */
+    while (not pq.empty()) pq.pop();
+
+    maxscore_terms.clear();
+    wand_enums.clear();
+
+    /* Remove UNKs. */
+    qterms.resize(query.terms.size());
+    std::iota(qterms.begin(), qterms.end(), 0);
+
+    auto is_unk = [&](auto idx) { return query.terms[idx] == Collection::UNK; };
+    qterms.erase(std::remove_if(qterms.begin(), qterms.end(), is_unk), qterms.end());
+
+    DocIDsReader doc_ids_reader{A.doc_ids};
+
+    for (auto i : qterms)
+    {
+        uint32_t idx = query.terms[i];
+
+        assert(A.terms[idx].local_df >= 1);
+
+        auto term_stats = UserTermStats(A.collection_stats, A.user_term_stats[idx]);
+
+        maxscore_terms.push_back({idx, i, open_list(doc_ids_reader, idx), term_stats,
+                                  A.maxscores[idx], uint32_t(-1), Score(), A.terms[idx].local_df, 0.0f,
+                                  {}, {}, {}});
+    }
+
+    /* After the last push_back, which may move the terms. */
+    for (auto &t : maxscore_terms) wand_enums.push_back(&t);
+    sort_by_docid(wand_enums);
+
+    return wand_enums.empty() ? UINT32_MAX : wand_enums[0]->reader.docid();
+}
+
+template <>
+void QueryProgram<WANDAlgorithm>::terms2docs(const Query &query, bool reset_threshold)
+{
+    const uint32_t max_doc = doc_end;
+
+    if (reset_threshold) threshold = model.threshold(query.terms.size());
+    query2terms(query);
+
+    global_doc_maxscore = model.self_receive(query.user_terms, A.global_doc_bound);
+
+    auto &enums = wand_enums;
+
+    while (true)
+    {
+        /* Pivot selection. */
+        auto     ub    = global_doc_maxscore;
+        uint32_t pivot = 0;
+
+        for (; pivot < enums.size(); pivot++)
+        {
+            ub += enums[pivot]->maxscore;
+            if (ub > threshold) break;
+        }
+
+        if (pivot == enums.size()) break;
+
+        uint32_t doc = enums[pivot]->reader.docid();
+        if (doc >= max_doc) break;
+
+        // pivot_selections++;
+
+        if (enums[0]->reader.docid() == doc)
+        {
+            // doc_evals++;
+            auto score = model.self_receive(query.user_terms, A.doc_messages[doc]);
+
+            for (auto t : enums)
+            {
+                if (t->reader.docid() != doc) break;
+
+                score += model.send(t->idf, t->reader.freq(), A.doc_stats[doc]);
+                t->reader.next();
+            }
+
+            topk_insert(doc, score);
+            sort_by_docid(enums);
+        }
+        else
+        {
+            /* Move the last list before the pivot up to it. */
+            while (enums[pivot]->reader.docid() == doc) pivot--;
+
+            enums[pivot]->reader.next_geq(doc);
+            bubble_down(enums, pivot);
+        }
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef CHUNKED_ARENA_
+#define CHUNKED_ARENA_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+
+/**
+ * Chunked Byte Arena
+ *
+ * Append-only byte storage that grows one chunk at a time: it needs no size bound up front, and
+ * never relocates what was already handed out. compact() then moves everything into a single
+ * exactly-sized buffer, releasing each chunk as soon as it is copied.
+ *
+ * Why this class?
+ *   >  The compressed size of the index is only known once it is built
+ *   >  Growing a single buffer (realloc) relocates it, and transiently needs twice the space
+ *
+ * Each allocate() is contiguous; the unused tail of a chunk that could not fit it is skipped.
+ **/
+
+
+class ChunkedArena
+{
+private:
+  struct Chunk
+  {
+    uint8_t* data;
+    size_t used;
+    size_t capacity;
+  };
+
+  std::vector<Chunk> chunks;
+  size_t chunk_bytes;
+  size_t total = 0;
+
+public:
+
+  ChunkedArena(size_t chunk_bytes = size_t(256) << 20) : chunk_bytes(chunk_bytes) {}
+
+  ChunkedArena(const ChunkedArena&) = delete;
+
+  ChunkedArena& operator=(const ChunkedArena&) = delete;
+
+  ~ChunkedArena() { clear(); }
+
+  /* Returns n contiguous (uninitialized) bytes, or nullptr if out of memory. */
+  uint8_t* allocate(size_t n)
+  {
+    if (chunks.empty() or chunks.back().used + n > chunks.back().capacity)
+    {
+      size_t capacity = std::max(chunk_bytes, n);
+      uint8_t* data = static_cast<uint8_t*>(malloc(capacity));
+      if (not data) return nullptr;
+
+      chunks.push_back({data, 0, capacity});
+    }
+
+    Chunk& c = chunks.back();
+    uint8_t* ptr = c.data + c.used;
+    c.used += n;
+    total += n;
+
+    return ptr;
+  }
+
+  /*
+   * Concatenates all allocations (in order) into one malloc'd buffer of size() + slack bytes, with the
+   * slack zeroed, and empties the arena. The caller owns (and free()s) the result; nullptr if out of memory.
+   */
+  uint8_t* compact(size_t slack = 0)
+  {
+    uint8_t* buf = static_cast<uint8_t*>(malloc(total + slack));
+    if (not buf) return nullptr;
+
+    size_t offset = 0;
+    for (auto& c : chunks)
+    {
+      memcpy(buf + offset, c.data, c.used);
+      offset += c.used;
+
+      free(c.data);
+      c.data = nullptr;
+    }
+
+    memset(buf + offset, 0, slack);
+
+    chunks.clear();
+    total = 0;
+
+    return buf;
+  }
+
+  void clear()
+  {
+    for (auto& c : chunks) free(c.data);
+    chunks.clear();
+    total = 0;
+  }
+
+  size_t size() const { return total; }
+};
+
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef FLAT_ROWS_
+#define FLAT_ROWS_
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+#include "structures/mapped_vector.h"
+
+
+/**
+ * Flat Rows
+ *
+ * A ragged 2D array (one row per term) in a single buffer: rows are laid out back to back, each
+ * starting on a cache line, and are found through the end offset of the row before.
+ *
+ * Why this class?
+ *   >  A vector per term and per kind of bound is millions of heap allocations per rank
+ *   >  Looking up a bound then chases a pointer to a row that can be anywhere in the heap
+ *
+ * rows[i] is a pointer to row i, so rows[i][j] reads like the vector-of-vectors it replaces.
+ *
+ * Like MappedVector, the rows can instead view() a layout that lives elsewhere (typically, inside a
+ * MappedFile), and are then read-only.
+ **/
+
+
+template <class Value>
+class FlatRows
+{
+public:
+  static constexpr size_t Alignment = 64;
+  static constexpr size_t Stride = Alignment / sizeof(Value);
+
+  static_assert(Alignment % sizeof(Value) == 0, "Values must tile a cache line");
+
+private:
+  MappedVector<uint64_t> ends;
+  Value* values = nullptr;
+  size_t n = 0;
+  bool mapped = false;
+
+public:
+
+  FlatRows() {}
+
+  FlatRows(const FlatRows&) = delete;
+
+  FlatRows& operator=(const FlatRows&) = delete;
+
+  ~FlatRows() { release(); }
+
+  /* Lays out nrows rows, of size_of(i) values each, all set to fill. */
+  template <class SizeOf>
+  void reset(size_t nrows, SizeOf size_of, const Value& fill = Value())
+  {
+    ends.clear();
+    ends.resize(nrows);
+
+    size_t end = 0;
+    for (size_t i = 0; i < nrows; i++) end = ends[i] = round_up(end) + size_of(i);
+
+    allocate(end);
+    std::fill(values, values + n, fill);
+  }
+
+  void assign(const std::vector<std::vector<Value>>& rows)
+  {
+    reset(rows.size(), [&](size_t i) { return rows[i].size(); });
+    for (size_t i = 0; i < rows.size(); i++) std::copy(rows[i].begin(), rows[i].end(), (*this)[i]);
+  }
+
+  /* Adopts (a copy of) the layout exposed by row_ends() and data(). */
+  void assign(const uint64_t* ends_, size_t nrows, const Value* values_, size_t nvalues)
+  {
+    assert(nvalues == (nrows ? ends_[nrows - 1] : 0));
+
+    ends.clear();
+    ends.resize(nrows);
+    std::copy(ends_, ends_ + nrows, ends.begin());
+
+    allocate(nvalues);
+    if (nvalues) memcpy(values, values_, nvalues * sizeof(Value));
+  }
+
+  /* Drops any owned storage and exposes the layout at ends_ and values_ (which must be aligned) instead. */
+  void view(const uint64_t* ends_, size_t nrows, const void* values_, size_t nvalues)
+  {
+    assert(nvalues == (nrows ? ends_[nrows - 1] : 0));
+    assert(reinterpret_cast<uintptr_t>(values_) % Alignment == 0);
+
+    release();
+    ends.view(ends_, nrows);
+    values = static_cast<Value*>(const_cast<void*>(values_));
+    n = nvalues;
+    mapped = true;
+  }
+
+  bool is_mapped() const { return mapped; }
+
+  size_t nrows() const { return ends.size(); }
+
+  /* Including the padding between rows. */
+  size_t nvalues() const { return n; }
+
+  size_t row_size(size_t row) const { return ends[row] - begin(row); }
+
+  Value* operator[](size_t row) const { return values + begin(row); }
+
+  Value* data() const { return values; }
+
+  const uint64_t* row_ends() const { return ends.data(); }
+
+private:
+  static size_t round_up(size_t i) { return (i + Stride - 1) / Stride * Stride; }
+
+  size_t begin(size_t row) const { return row ? round_up(ends[row - 1]) : 0; }
+
+  void release()
+  {
+    if (not mapped) free(values);
+    values = nullptr;
+    n = 0;
+    mapped = false;
+  }
+
+  void allocate(size_t size)
+  {
+    release();
+    n = size;
+
+    void* ptr = nullptr;
+    if (posix_memalign(&ptr, Alignment, std::max(size_t(1), size) * sizeof(Value))) throw std::bad_alloc();
+    values = static_cast<Value*>(ptr);
+  }
+};
+
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef MAPPED_VECTOR_
+#define MAPPED_VECTOR_
+
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+
+/**
+ * Mappable Vector
+ *
+ * Behaves like a std::vector while the index is being built, and can then be re-pointed at an
+ * array that lives elsewhere (typically, inside a MappedFile) without copying it.
+ *
+ * Why this class?
+ *   >  The cached index arrays (terms, doc stats) are used in place from the page cache on load
+ *   >  The build path still wants push_back()/resize() on owned storage
+ *
+ * Once view() is called, the vector is read-only: growing it is a bug, and writing faults when
+ * the viewed memory is a read-only mapping.
+ **/
+
+
+template <class Value>
+class MappedVector
+{
+public:
+  using Type = Value;
+
+private:
+  std::vector<Value> owned;
+
+  Value* values = nullptr;
+  size_t n = 0;
+  bool mapped = false;
+
+public:
+
+  MappedVector() {}
+
+  MappedVector(const MappedVector&) = delete;
+
+  MappedVector& operator=(const MappedVector&) = delete;
+
+  void push_back(const Value& v)
+  {
+    assert(not mapped);
+    owned.push_back(v);
+    sync();
+  }
+
+  void resize(size_t size)
+  {
+    assert(not mapped);
+    owned.resize(size);
+    sync();
+  }
+
+  void clear()
+  {
+    owned.clear();
+    owned.shrink_to_fit();
+    mapped = false;
+    sync();
+  }
+
+  /* Drops any owned storage and exposes [ptr, ptr + size) instead. */
+  void view(const void* ptr, size_t size)
+  {
+    owned.clear();
+    owned.shrink_to_fit();
+
+    values = static_cast<Value*>(const_cast<void*>(ptr));
+    n = size;
+    mapped = true;
+  }
+
+  bool is_mapped() const { return mapped; }
+
+  size_t size() const { return n; }
+
+  bool empty() const { return n == 0; }
+
+public:
+  Value& operator[](size_t idx) const { return values[idx]; }
+
+  Value& back() const { assert(n >= 1); return values[n - 1]; }
+
+  Value* begin() const { return values; }
+
+  Value* end() const { return values + n; }
+
+  Value* data() const { return values; }
+
+private:
+  void sync()
+  {
+    values = owned.data();
+    n = owned.size();
+  }
+};
+
+
+#endif
@@ -12,6 +12,44 @@
 // #define SHARD_RADIX 9
 #define SHARD_NDOCS (1 << SHARD_RADIX)
 
+/* Coarser levels of the doc-range bounds: each level groups 1 << PYRAMID_RADIX ranges of the level below. */
+#ifndef PYRAMID_LEVELS
+#define PYRAMID_LEVELS 2
+#endif
+
+#ifndef PYRAMID_RADIX
+#define PYRAMID_RADIX 5
+#endif
+
+/* Width of the quantized block bounds: 4, 8 or 16 bits per code (see quantized_bounds.h). */
+#ifndef BOUND_BITS
+#define BOUND_BITS 8
+#endif
+
+/* Bound MaxScore and LazyMaxScore with VBMW's variable-sized blocks (optimizer.vbmw.h) instead of doc ranges. */
+#ifndef VBMW_BOUNDS
+#define VBMW_BOUNDS false
+#endif
+
+/* Whether optimize_model() partitions the lists into VBMW blocks (-DVBMW or VBMW_BOUNDS), which then bound every
+ * query program: the block-max ones per block, and the doc-range ones per range over the blocks it overlaps. */
+#define VBMW_BLOCKS (VBMW or VBMW_BOUNDS)
+
+/* Size the block bounds of long lists by replaying the query log (block_tuner.h) instead of by df alone. */
+#ifndef TUNE_BLOCK_SHIFTS
+#define TUNE_BLOCK_SHIFTS false
+#endif
+
+/* Threads per query (parallel.h): more than one splits each query's docs into windows scored concurrently. */
+#ifndef QUERY_THREADS
+#define QUERY_THREADS 1
+#endif
+
+/* Queries served at once per rank (server.h), after the one-at-a-time runs: more than one measures throughput. */
+#ifndef QUERY_WORKERS
+#define QUERY_WORKERS 1
+#endif
+
 #define FULL_EVAL_SHARD_RADIX 13
 #define FULL_EVAL_SHARD_NDOCS (1 << FULL_EVAL_SHARD_RADIX)
 
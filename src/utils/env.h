@@ -34,7 +34,7 @@ public:
 
   static void finalize();
 
-  static void exit(int code);
+  [[noreturn]] static void exit(int code);
 
   static void barrier();  // global barrier
 
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdint>
+#include <string>
+#include "utils/env.h"
+#include "utils/log.h"
+
+/*
+ * Read-only, shared mapping of a whole file.
+ *
+ * Pages are shared through the page cache, so ranks on the same host that map the same files pay for
+ * them once. The mapping is always followed by at least one zero page: the Elias-Fano readers load
+ * whole words past the end of their lists, and must never fault on the last list of a file.
+ */
+class MappedFile
+{
+   public:
+    MappedFile() = default;
+
+    MappedFile(const std::string &path, bool populate = false)
+    {
+        open(path, populate);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    MappedFile(MappedFile &&other) : base(other.base), nbytes(other.nbytes), reserved(other.reserved)
+    {
+        other.base     = nullptr;
+        other.nbytes   = 0;
+        other.reserved = 0;
+    }
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    void open(const std::string &path, bool populate = false)
+    {
+        close();
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            LOG.info("Unable to open %s\n", path.c_str());
+            Env::exit(1);
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            LOG.info("stat() failure on %s\n", path.c_str());
+            Env::exit(1);
+        }
+
+        size_t page = sysconf(_SC_PAGESIZE);
+        nbytes      = st.st_size;
+        reserved    = (nbytes / page + 2) * page;
+
+        /* Reserve the range (with the trailing zero page), then map the file over its head. */
+        void *addr = mmap(nullptr, reserved, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED)
+        {
+            LOG.info("mmap() failure on %s\n", path.c_str());
+            Env::exit(1);
+        }
+
+        base = static_cast<uint8_t *>(addr);
+
+        if (nbytes > 0)
+        {
+            int flags = MAP_SHARED | MAP_FIXED | (populate ? MAP_POPULATE : 0);
+            if (mmap(base, nbytes, PROT_READ, flags, fd, 0) == MAP_FAILED)
+            {
+                LOG.info("mmap() failure on %s\n", path.c_str());
+                Env::exit(1);
+            }
+        }
+
+        ::close(fd);
+    }
+
+    void close()
+    {
+        if (base) munmap(base, reserved);
+
+        base     = nullptr;
+        nbytes   = 0;
+        reserved = 0;
+    }
+
+    /* Hint the kernel about the expected access pattern (e.g., MADV_WILLNEED, MADV_RANDOM). */
+    void advise(int advice) const
+    {
+        if (nbytes > 0) madvise(base, nbytes, advice);
+    }
+
+    /* NOTE: Pages are mapped read-only; writing through this pointer faults. */
+    uint8_t *data() const
+    {
+        return base;
+    }
+
+    size_t size() const
+    {
+        return nbytes;
+    }
+
+   private:
+    uint8_t *base     = nullptr;
+    size_t   nbytes   = 0;
+    size_t   reserved = 0;
+};